@@ -19,26 +19,152 @@
 #include "ns3/internet-module.h"
 #include "ns3/point-to-point-module.h"
 #include "ns3/applications-module.h"
+#include "ns3/realtime-simulator-impl.h"
 #include <fstream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
 #include "ns3/flow-monitor-module.h"
+#include "../common/counting-scheduler.h"
+#include "../common/lab-log.h"
+#include "../common/latency-histogram.h"
+#include "../common/hash-flow-monitor.h"
 
 using namespace ns3;
 using namespace std;
 NS_LOG_COMPONENT_DEFINE ("Lab-4-1");
 
+// Components that log every echo packet with --verbosity=2
+static const char *packetLogs[] = { "UdpEchoClientApplication", "UdpEchoServerApplication", 0 };
+
+// Echo requests in flight, in a table indexed by the low bits of the packet
+// uid, and the histogram of round trip times in nanoseconds. The echo server
+// sends the very packet back, so the uid matches on return. Uids grow by one
+// per packet, so a slot is only reused once the table size of newer packets
+// exists. The table is sized for the requests that can be in flight at once,
+// not for the whole run; a request still waiting when its slot is reused is
+// evicted: it was lost, or its reply took far longer than expected.
+struct EchoSlot
+{
+  uint64_t uid;
+  int64_t sent;
+  bool busy;
+};
+static vector<EchoSlot> inFlight;
+static uint64_t inFlightMask;
+static uint64_t echoesSent = 0;
+static uint64_t echoesEvicted = 0;
+static LatencyHistogram rttHistogram;
+
+// Real-time mode: how far behind the wall clock every event ran, in
+// nanoseconds, and how many events were later than the hard limit
+static Ptr<RealtimeSimulatorImpl> realtime;
+static LatencyHistogram lagHistogram;
+static int64_t hardLimitNs = 0;
+static uint64_t overruns = 0;
+
+// Called by the scheduler right before the simulator runs an event
+static void
+RecordLag (const Scheduler::Event &ev)
+{
+  int64_t lag = realtime->RealtimeNow ().GetNanoSeconds () - static_cast<int64_t> (ev.key.m_ts);
+  if (lag < 0)
+    {
+      lag = 0;
+    }
+  lagHistogram.Record (lag);
+  if (lag > hardLimitNs)
+    {
+      overruns++;
+    }
+}
+
+// Client sent an echo request
+static void
+EchoTx (Ptr<const Packet> p)
+{
+  EchoSlot &slot = inFlight[p->GetUid () & inFlightMask];
+  if (slot.busy)
+    {
+      echoesEvicted++;
+    }
+  slot.uid = p->GetUid ();
+  slot.sent = Simulator::Now ().GetNanoSeconds ();
+  slot.busy = true;
+  echoesSent++;
+}
+
+// A packet arrived at node 0; if it is an echo reply, take its round trip time
+static void
+EchoRx (Ptr<const Packet> p)
+{
+  EchoSlot &slot = inFlight[p->GetUid () & inFlightMask];
+  if (slot.busy && slot.uid == p->GetUid ())
+    {
+      rttHistogram.Record (Simulator::Now ().GetNanoSeconds () - slot.sent);
+      slot.busy = false;
+    }
+}
+
 int
 main (int argc, char *argv[])
 {
 
   double delay = 2;
+  uint32_t pairs = 2;
+  uint32_t packets = 1;
+  double interval = 1.0;
+  uint32_t packetSize = 1024;
+  uint32_t verbosity = LAB_QUIET;
+  bool tracing = true;
+  bool realtimeMode = false;
+  double hardLimit = 10;
+  std::string classifier = "ordered";
   Time::SetResolution (Time::NS);
-  LogComponentEnable ("UdpEchoClientApplication", LOG_LEVEL_INFO);
-  LogComponentEnable ("UdpEchoServerApplication", LOG_LEVEL_INFO);
   
   CommandLine cmd;
   cmd.AddValue("delay", "P2P delay /latency in ms ", delay);
+  cmd.AddValue("pairs", "Number of echo client/server pairs (ports 9000, 9001, ...)", pairs);
+  cmd.AddValue("packets", "Echo requests sent by each client", packets);
+  cmd.AddValue("interval", "Seconds between two requests of a client", interval);
+  cmd.AddValue("size", "Echo request size in bytes", packetSize);
+  cmd.AddValue("classifier", "FlowMonitor flow classifier: 'ordered' (Ipv4FlowClassifier) or 'hash' (faster with many pairs)", classifier);
+  cmd.AddValue("verbosity", "0 quiet, 1 progress, 2 every packet (skews timing)", verbosity);
+  cmd.AddValue("tracing", "Write lab-4-1.tr and the pcap files", tracing);
+  cmd.AddValue("realtime", "Run in step with the wall clock and report how far the events lag behind it", realtimeMode);
+  cmd.AddValue("hardLimit", "Real-time lag in ms above which an event counts as an overrun", hardLimit);
   cmd.Parse(argc,argv);
 
+  EnableLabLogging (verbosity, "Lab-4-1", packetLogs);
+
+  if (classifier != "ordered" && classifier != "hash")
+    {
+      NS_LOG_UNCOND ("The classifier must be either 'ordered' or 'hash'.");
+      return 1;
+    }
+
+  // The real-time simulator has to be chosen before the scheduler creates
+  // the simulator. It runs best effort: an event that is late is still run,
+  // and counted as an overrun if it is later than the hard limit, rather
+  // than aborting the run like the HardLimit mode does.
+  if (realtimeMode)
+    {
+      GlobalValue::Bind ("SimulatorImplementationType", StringValue ("ns3::RealtimeSimulatorImpl"));
+      Config::SetDefault ("ns3::RealtimeSimulatorImpl::SynchronizationMode", StringValue ("BestEffort"));
+      hardLimitNs = static_cast<int64_t> (hardLimit * 1e6);
+    }
+
+  // Count the executed events, keeping the default scheduler
+  UseCountingScheduler ("ns3::MapScheduler");
+  if (realtimeMode)
+    {
+      realtime = DynamicCast<RealtimeSimulatorImpl> (Simulator::GetImplementation ());
+      CountingScheduler::SetObserver (&RecordLag);
+    }
+
+  // The clients start at 2s and stop once they had time for every request
+  double clientStop = max (10.0, 2.0 + packets * interval + 1.0);
+
   NodeContainer nodes;
   nodes.Create (2);
 
@@ -57,46 +183,61 @@ main (int argc, char *argv[])
 
   Ipv4InterfaceContainer interfaces = address.Assign (devices);
 
-  UdpEchoServerHelper echoServer1 (9000);
-  UdpEchoServerHelper echoServer2 (9001);
-  
-  ApplicationContainer serverApps = echoServer1.Install (nodes.Get (1));
-  serverApps.Start (Seconds (1.0));
-  serverApps.Stop (Seconds (10.0));
+  // One server on node 1 and one client on node 0 per pair
+  ApplicationContainer serverApps;
+  ApplicationContainer clientApps;
+  for (uint32_t i = 0; i < pairs; ++i)
+    {
+      UdpEchoServerHelper echoServer (9000 + i);
+      serverApps.Add (echoServer.Install (nodes.Get (1)));
 
-  serverApps = echoServer2.Install (nodes.Get (1));
+      UdpEchoClientHelper echoClient (interfaces.GetAddress (1), 9000 + i);
+      echoClient.SetAttribute ("MaxPackets", UintegerValue (packets));
+      echoClient.SetAttribute ("Interval", TimeValue (Seconds (interval)));
+      echoClient.SetAttribute ("PacketSize", UintegerValue (packetSize));
+      clientApps.Add (echoClient.Install (nodes.Get (0)));
+    }
   serverApps.Start (Seconds (1.0));
-  serverApps.Stop (Seconds (10.0));
-
-  UdpEchoClientHelper echoClient1 (interfaces.GetAddress (1), 9000);
-  echoClient1.SetAttribute ("MaxPackets", UintegerValue (1));
-  echoClient1.SetAttribute ("Interval", TimeValue (Seconds (1.0)));
-  echoClient1.SetAttribute ("PacketSize", UintegerValue (1024));
-  ApplicationContainer clientApps = echoClient1.Install (nodes.Get (0));
+  serverApps.Stop (Seconds (clientStop));
   clientApps.Start (Seconds (2.0));
-  clientApps.Stop (Seconds (10.0));
+  clientApps.Stop (Seconds (clientStop));
 
-
-  UdpEchoClientHelper echoClient2 (interfaces.GetAddress (1), 9001);
-  echoClient2.SetAttribute ("MaxPackets", UintegerValue (1));
-  echoClient2.SetAttribute ("Interval", TimeValue (Seconds (1.0)));
-  echoClient2.SetAttribute ("PacketSize", UintegerValue (1024));
-  clientApps = echoClient2.Install (nodes.Get (0));
-  clientApps.Start (Seconds (2.0));
-  clientApps.Stop (Seconds (10.0));
+  // Round trip times: requests leave the clients, replies arrive at node 0's device.
+  // Requests in flight: every client sends one per interval, and a round trip
+  // takes both propagation delays plus, at worst, a request and a reply of
+  // every pair queued on the 5Mbps link. Four times that, between 64 and 64K
+  // slots (1.5MB), whatever the length of the run.
+  double rtt = 2 * delay / 1000.0 + 2.0 * pairs * (packetSize + 30) * 8 / 5e6;
+  double outstanding = pairs * ceil (rtt / interval + 1);
+  uint64_t slots = 64;
+  while (slots < 4 * outstanding && slots < (1ull << 16))
+    {
+      slots <<= 1;
+    }
+  EchoSlot idle = { 0, 0, false };
+  inFlight.assign (slots, idle);
+  inFlightMask = slots - 1;
+  for (uint32_t i = 0; i < clientApps.GetN (); ++i)
+    {
+      clientApps.Get (i)->TraceConnectWithoutContext ("Tx", MakeCallback (&EchoTx));
+    }
+  devices.Get (0)->TraceConnectWithoutContext ("MacRx", MakeCallback (&EchoRx));
 
 
   //
   // Tracing
   //
-    AsciiTraceHelper ascii;
-    pointToPoint.EnableAscii(ascii.CreateFileStream ("lab-4-1.tr"), devices);
-    pointToPoint.EnablePcap("lab-4-1",devices, false);
+  if (tracing)
+    {
+      AsciiTraceHelper ascii;
+      pointToPoint.EnableAscii(ascii.CreateFileStream ("lab-4-1.tr"), devices);
+      pointToPoint.EnablePcap("lab-4-1",devices, false);
+    }
 
   //
   // Calculate Throughput using Flowmonitor
   //
-    FlowMonitorHelper flowmon;
+    HashFlowMonitorHelper flowmon (classifier == "hash");
     Ptr<FlowMonitor> monitor = flowmon.InstallAll();
 
 
@@ -104,16 +245,26 @@ main (int argc, char *argv[])
   // Now, do the actual simulation.
   //
     NS_LOG_INFO ("Run Simulation.");
-    Simulator::Stop (Seconds(11.0));
+    Simulator::Stop (Seconds(clientStop + 1.0));
+    SystemWallClockMs wallClock;
+    wallClock.Start ();
     Simulator::Run ();
+    double wallSeconds = wallClock.End () / 1000.0;
 
-    Ptr<Ipv4FlowClassifier> classifier = DynamicCast<Ipv4FlowClassifier> (flowmon.GetClassifier ());
+    Ptr<Ipv4FlowClassifier> flowClassifier = DynamicCast<Ipv4FlowClassifier> (flowmon.GetClassifier ());
     std::map<FlowId, FlowMonitor::FlowStats> stats = monitor->GetFlowStats ();
+    uint64_t totalRxBytes = 0;
     for (std::map<FlowId, FlowMonitor::FlowStats>::const_iterator i = stats.begin (); i != stats.end (); ++i)
       {
-      Ipv4FlowClassifier::FiveTuple t = classifier->FindFlow (i->first);
+      Ipv4FlowClassifier::FiveTuple t = flowClassifier->FindFlow (i->first);
         if ((t.sourceAddress=="10.1.1.1" && t.destinationAddress == "10.1.1.2"))
         {
+            totalRxBytes += i->second.rxBytes;
+            // With many pairs only the summary below is printed
+            if (pairs > 10)
+              {
+                continue;
+              }
             std::cout << "Flow " << i->first  << " (" << t.sourceAddress<<":"<<t.sourcePort << " -> " << t.destinationAddress <<":"<<t.destinationPort<< ")\n";
             std::cout << "  Tx Bytes:   " << i->second.txBytes << "\n";
             std::cout << "  Rx Bytes:   " << i->second.rxBytes << "\n";
@@ -121,6 +272,44 @@ main (int argc, char *argv[])
         }
        }
 
+    // Simulator overhead and echo latency
+    uint64_t events = CountingScheduler::GetExecuted ();
+    std::cout << "Echo load: " << pairs << " pairs x " << packets << " packets of " << packetSize << " bytes, "
+              << totalRxBytes << " bytes received by the servers\n";
+    std::cout << "  Events:     " << events << " in " << wallSeconds << " s wall clock ("
+              << (wallSeconds > 0 ? events / wallSeconds : 0) << " events/s)\n";
+    std::cout << "  Round trips: " << rttHistogram.GetCount () << " of " << echoesSent << " completed";
+    if (rttHistogram.GetCount () < echoesSent)
+      {
+        std::cout << " (" << echoesSent - rttHistogram.GetCount () << " unanswered";
+        if (echoesEvicted > 0)
+          {
+            std::cout << ", " << echoesEvicted << " of them given up on after " << inFlight.size ()
+                      << " newer packets";
+          }
+        std::cout << ")";
+      }
+    std::cout << "\n";
+    if (rttHistogram.GetCount () > 0)
+      {
+        std::cout << "  RTT (ms):   p50 " << rttHistogram.ValueAtPercentile (50) / 1e6
+                  << "  p99 " << rttHistogram.ValueAtPercentile (99) / 1e6
+                  << "  p99.9 " << rttHistogram.ValueAtPercentile (99.9) / 1e6
+                  << "  max " << rttHistogram.GetMax () / 1e6 << "\n";
+      }
+    if (realtimeMode)
+      {
+        // The run kept up if no event was later than the hard limit
+        std::cout << "  Real-time lag (ms): p50 " << lagHistogram.ValueAtPercentile (50) / 1e6
+                  << "  p99 " << lagHistogram.ValueAtPercentile (99) / 1e6
+                  << "  p99.9 " << lagHistogram.ValueAtPercentile (99.9) / 1e6
+                  << "  max " << lagHistogram.GetMax () / 1e6 << "\n";
+        std::cout << "  Overruns:   " << overruns << " of " << lagHistogram.GetCount () << " events later than "
+                  << hardLimit << " ms (" << (overruns == 0 ? "keeps up" : "falls behind") << ")\n";
+        CountingScheduler::SetObserver (0);
+        realtime = 0;
+      }
+
 
 
   Simulator::Destroy ();
@@ -20,6 +20,12 @@
 #include <fstream>
 #include <string>
 #include <cassert>
+#include <sstream>
+#include <iomanip>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <time.h>
 #include "ns3/core-module.h"
 #include "ns3/network-module.h"
 #include "ns3/internet-module.h"
@@ -28,14 +34,135 @@
 #include "ns3/ipv4-global-routing-helper.h"
 #include "ns3/flow-monitor-module.h"
 #include "ns3/flow-monitor-helper.h"
+#include "../common/trace-writer.h"
+#include "../common/lab-log.h"
+#include "../common/flight-recorder.h"
+#include "../common/hop-latency.h"
+#include "../common/hash-flow-monitor.h"
 
 using namespace std;
 using namespace ns3;
 
 NS_LOG_COMPONENT_DEFINE ("DynamicRoutingProtocol");
-ofstream fp;
-FlowMonitorHelper flowmonhelper;
+
+/**
+ * Components that log every packet with --verbosity=2.
+ * OnOffApplication is used to send CBR packets over links.
+ * Packet Sink is installed at the receiver node to receieve the packets.
+ */
+static const char *packetLogs[] = { "OnOffApplication", "PacketSink", 0 };
+ColumnTraceWriter lossColumns;		//lossVsTime.col, with --traceFormat=binary; outlives traceWriter
+TraceWriter traceWriter;		//lossVsTime.txt is written through this
+int lossFile;
+HashFlowMonitorHelper flowmonhelper (false);	//the stock FlowMonitorHelper unless --classifier=hash or --monitor
 Ptr<FlowMonitor> mon;
+FlightRecorder *recorder = 0;		//with --capture=triggered
+double lossSpike = 0.1;			//loss ratio rise between two samples that triggers a capture
+double lastRatio = 0;
+
+/**
+ * Saves the packets around this moment when capturing with the flight recorder
+ */
+void captureTrigger (string reason)
+{
+	if (recorder)
+	{
+		NS_LOG_INFO ("Capture triggered at " << Simulator::Now ().GetSeconds () << "s: " << reason);
+		recorder->Trigger ();
+	}
+}
+
+/**
+ * One interface change of the failure schedule and what it caused.
+ * Drops are counted from the event until the next one; the network has
+ * reconverged once the last of them happened.
+ */
+struct FailureEvent
+{
+	double time;
+	uint32_t node;
+	uint32_t interface;
+	bool up;
+	double recomputeMs;	//wall clock time of SetDown/SetUp, which rebuilds the global routes
+	uint64_t drops;		//packets dropped by IP until the next event
+	double lastDrop;	//simulation time of the last of them
+};
+vector<FailureEvent> failures;
+int currentFailure = -1;	//the last event that happened
+
+static bool earlierFailure (const FailureEvent &a, const FailureEvent &b)
+{
+	return a.time < b.time;
+}
+
+static double wallNowMs ()
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * Reads the failure schedule: one "<time> <node> <interface> down|up" per
+ * line, '#' starts a comment. Returns false if a line cannot be read.
+ * The events are sorted by time (events at the same time keep the file
+ * order), since drops are charged to the last event that happened.
+ */
+static bool loadFailures (const string &fileName, vector<FailureEvent> &events)
+{
+	ifstream in (fileName.c_str ());
+	if (!in)
+		return false;
+	string line;
+	while (getline (in, line))
+	{
+		line = line.substr (0, line.find ('#'));
+		istringstream is (line);
+		FailureEvent event;
+		string state;
+		if (!(is >> event.time))
+			continue;		//blank or comment line
+		if (!(is >> event.node >> event.interface >> state) || (state != "down" && state != "up"))
+			return false;
+		event.up = state == "up";
+		event.recomputeMs = 0;
+		event.drops = 0;
+		event.lastDrop = event.time;
+		events.push_back (event);
+	}
+	stable_sort (events.begin (), events.end (), earlierFailure);
+	return true;
+}
+
+/**
+ * Takes an interface of the failure schedule down or up; an interface change
+ * triggers a capture. With RespondToInterfaceEvents the global routes are
+ * rebuilt inside SetDown/SetUp, so timing the call measures the recomputation.
+ */
+void applyFailure (Ptr<Ipv4> ipv4, uint32_t i)
+{
+	FailureEvent &event = failures[i];
+	captureTrigger (event.up ? "interface up" : "interface down");
+	double start = wallNowMs ();
+	if (event.up)
+		ipv4->SetUp (event.interface);
+	else
+		ipv4->SetDown (event.interface);
+	event.recomputeMs = wallNowMs () - start;
+	currentFailure = i;
+}
+
+/**
+ * Every packet IP drops anywhere counts against the last failure event
+ */
+void ipv4Drop (const Ipv4Header &header, Ptr<const Packet> p, Ipv4L3Protocol::DropReason reason, Ptr<Ipv4> ipv4, uint32_t interface)
+{
+	if (currentFailure >= 0)
+	{
+		failures[currentFailure].drops++;
+		failures[currentFailure].lastDrop = Simulator::Now ().GetSeconds ();
+	}
+}
 
 /**
  * Function to calculate packet lost and loss ratio
@@ -72,7 +199,19 @@ void lossCalculator ()
 		ratio=0;
 	else
 		ratio = (double)lostPcktsTemp/(double)transmittedPcktsTemp ;
-	fp << Simulator::Now ().GetSeconds () <<" "<< ratio << endl;
+	if (ratio - lastRatio >= lossSpike)
+		captureTrigger ("loss spike");
+	lastRatio = ratio;
+	traceWriter.WriteReal (lossFile, Simulator::Now ().GetSeconds (), ratio);
+}
+
+/**
+ * Formats one line of lossVsTime.txt; runs on the trace writer thread
+ * when --asyncTrace is on
+ */
+static void FormatLoss (ostream &os, const TraceRecord &r)
+{
+	os << r.time << " " << r.real << "\n";
 }
 
 int main(int argc, char *argv[])
@@ -80,21 +219,19 @@ int main(int argc, char *argv[])
 	
 	
 	string latency = "2ms";
-	
-	/**
-	 * To enable logging for each and every component.
-	 * OnOffApplication is used to send CBR packets over links.
-	 * Packet Sink is installed at the receiver node to receieve the packets.
-	 */
-	LogComponentEnable ("OnOffApplication", LOG_LEVEL_INFO);
-	LogComponentEnable ("PacketSink", LOG_LEVEL_INFO);
+	bool asyncTrace = true;
+	string traceFormat = "text";
+	uint32_t verbosity = LAB_QUIET;
+	string capture = "full";
+	uint32_t captureRing = 1000;
+	double capturePre = 0.2;
+	double capturePost = 0.5;
+	string captureAt = "";
+	string failureFile = "";
+	bool hopDelays = false;
+	string monitor = "all";
+	string classifier = "ordered";
 
-	fp.open ("lossVsTime.txt");
-	if (!fp)
-	{
-		cout << "Cannot open the output file" << endl;
-		exit (1);
-	}
 	/**
 	 * The following configures the default behaviour of the global routing protocol
 	 * Set to true if you want the protocol to respond to Interface Events.
@@ -103,8 +240,60 @@ int main(int argc, char *argv[])
 
 	CommandLine cmd;
 	cmd.AddValue ("latency", "link Latency(in ms)", latency);
+	cmd.AddValue ("asyncTrace", "Format and write lossVsTime.txt on a background thread", asyncTrace);
+	cmd.AddValue ("traceFormat", "Loss trace format: 'text' (lossVsTime.txt) or 'binary' (lossVsTime.col)", traceFormat);
+	cmd.AddValue ("capture", "Packet capture: 'full' (globalRouting.tr and pcap of the whole run) or 'triggered' (pcap around the triggers only)", capture);
+	cmd.AddValue ("captureRing", "With --capture=triggered, packets kept in memory per device", captureRing);
+	cmd.AddValue ("capturePre", "With --capture=triggered, seconds saved before a trigger", capturePre);
+	cmd.AddValue ("capturePost", "With --capture=triggered, seconds written after a trigger", capturePost);
+	cmd.AddValue ("captureAt", "With --capture=triggered, comma separated times (s) that trigger a capture, besides the interface changes", captureAt);
+	cmd.AddValue ("lossSpike", "With --capture=triggered, rise of the loss ratio between two samples that triggers a capture", lossSpike);
+	cmd.AddValue ("failures", "Failure schedule file, one '<time> <node> <interface> down|up' per line (default: node 1 interface 1 down at 2s, up at 2.7s)", failureFile);
+	cmd.AddValue ("monitor", "Flow monitor probes: 'all' nodes, the flow 'endpoints' or a comma separated list of node ids; other nodes only report drops", monitor);
+	cmd.AddValue ("classifier", "Flow monitor classifier: 'ordered' (Ipv4FlowClassifier) or 'hash'", classifier);
+	cmd.AddValue ("hopDelays", "Tag every packet with its per hop queueing and wire delays and print them per path", hopDelays);
+	cmd.AddValue ("verbosity", "0 quiet, 1 progress, 2 every packet (skews timing)", verbosity);
 	cmd.Parse (argc, argv);
 
+	if (classifier != "ordered" && classifier != "hash")
+	{
+		cout << "The classifier must be either 'ordered' or 'hash'" << endl;
+		exit (1);
+	}
+	flowmonhelper.SetUseHash (classifier == "hash");
+
+	if (capture != "full" && capture != "triggered")
+	{
+		cout << "The capture must be either 'full' or 'triggered'" << endl;
+		exit (1);
+	}
+
+	EnableLabLogging (verbosity, "DynamicRoutingProtocol", packetLogs);
+
+	if (traceFormat == "binary")
+	{
+		//read it back with tools/trace-export lossVsTime.col --xy
+		if (!lossColumns.Open ("lossVsTime.col"))
+		{
+			cout << "Cannot open the output file" << endl;
+			exit (1);
+		}
+		lossFile = traceWriter.AddColumnStream (&lossColumns, COLUMN_NO_FLOW, lossColumns.AddEvent ("loss"), true);
+	}
+	else
+	{
+		lossFile = traceWriter.AddStream ("lossVsTime.txt", &FormatLoss);
+		if (lossFile < 0)
+		{
+			cout << "Cannot open the output file" << endl;
+			exit (1);
+		}
+	}
+
+	//lossCalculator only queues records from here on; the file is flushed at Simulator::Destroy
+	traceWriter.Start (asyncTrace);
+	Simulator::ScheduleDestroy (&TraceWriter::Stop, &traceWriter);
+
 	NS_LOG_INFO ("Create nodes.");
 	NodeContainer nodes;	//creating all the 5 nodes
 	nodes.Create(5);
@@ -243,34 +432,97 @@ int main(int argc, char *argv[])
 
 
 	/**
-	 * To schedule the setDown to set the link down for link0-1
-	 * we need to get the IP of the node1
+	 * The failure schedule. Without a file the link0-1 goes down at t=2 and up
+	 * at t=2.7 on node1's side: its interface0 is the loopback and interface 1
+	 * is for the n0-n1 P2P link.
 	 */
-	Ptr<Node> n1 = nodes.Get (1);
-	Ptr<Ipv4> ipNode1 = n1->GetObject<Ipv4> ();
+	if (failureFile.empty ())
+	{
+		FailureEvent down = { 2.0, 1, 1, false, 0, 0, 2.0 };		//link down at t=2
+		FailureEvent up = { 2.7, 1, 1, true, 0, 0, 2.7 };		//link up at t=2.7
+		failures.push_back (down);
+		failures.push_back (up);
+	}
+	else if (!loadFailures (failureFile, failures))
+	{
+		cout << "Cannot read the failure schedule " << failureFile << endl;
+		exit (1);
+	}
+	for (uint32_t i = 0; i < failures.size (); ++i)
+	{
+		if (failures[i].node >= nodes.GetN ())
+		{
+			cout << "The failure schedule names node " << failures[i].node << ", there are " << nodes.GetN () << endl;
+			exit (1);
+		}
+		Ptr<Ipv4> ipv4 = nodes.Get (failures[i].node)->GetObject<Ipv4> ();
+		if (failures[i].interface == 0 || failures[i].interface >= ipv4->GetNInterfaces ())
+		{
+			cout << "Node " << failures[i].node << " has no interface " << failures[i].interface << endl;
+			exit (1);
+		}
+		Simulator::Schedule (Seconds (failures[i].time), &applyFailure, ipv4, i);
+	}
+	Config::ConnectWithoutContext ("/NodeList/*/$ns3::Ipv4L3Protocol/Drop", MakeCallback (&ipv4Drop));
 
 	/**
-	 * Now node1 has many interfaces. The interface0 is for loopback
-	 * Interface 1 if for the n0-n1 P2P link
-	 * Interface 1 if for the n0-n3 P2P link
+	 * For tracing purposes
+	 * The flight recorder keeps the last packets of every device in memory and
+	 * only writes DynamicRoutingProtocol-*.pcap around the triggers
 	 */
-	uint32_t index = 1;		//selecting the interface1
+	if (capture == "triggered")
+	{
+		NetDeviceContainer allDevices (device0_1, device1_2);
+		allDevices.Add (device0_3);
+		allDevices.Add (device3_4);
+		allDevices.Add (device4_2);
+		recorder = new FlightRecorder ("DynamicRoutingProtocol", captureRing, Seconds (capturePre), Seconds (capturePost));
+		recorder->Install (allDevices);
+
+		stringstream ss (captureAt);
+		string item;
+		while (getline (ss, item, ','))
+			Simulator::Schedule (Seconds (atof (item.c_str ())), &captureTrigger, string ("scheduled"));
+	}
+	else
+	{
+		AsciiTraceHelper ascii;
+		Ptr<OutputStreamWrapper> stream = ascii.CreateFileStream ("globalRouting.tr");
+		point2point.EnableAsciiAll (stream);
 
-	Simulator::Schedule (Seconds (2.0), &Ipv4::SetDown, ipNode1, index);	//link down at t=2
-	Simulator::Schedule (Seconds (2.7), &Ipv4::SetUp, ipNode1, index);		//link up at t=2.7
+		st.EnableAsciiIpv4All (stream);		//stack
+		point2point.EnablePcapAll("DynamicRoutingProtocol");
+	}
 
 	/**
-	 * For tracing purposes
+	 * Per hop delays: shows where the reroute over n3-n4 (500Kbps) adds delay
 	 */
-	AsciiTraceHelper ascii;
-	Ptr<OutputStreamWrapper> stream = ascii.CreateFileStream ("globalRouting.tr");
-	point2point.EnableAsciiAll (stream);
-
-	st.EnableAsciiIpv4All (stream);		//stack
-	point2point.EnablePcapAll("DynamicRoutingProtocol");
+	HopLatency hopLatency;
+	if (hopDelays)
+		hopLatency.Install (nodes);
 
 	// Flow Monitor to monitor the entire traffic
-	mon = flowmonhelper.InstallAll();		//Flow monitor installed over the entire network
+	if (monitor == "all")
+		mon = flowmonhelper.InstallAll();		//Flow monitor installed over the entire network
+	else if (monitor == "endpoints")
+		mon = flowmonhelper.InstallSelected (HashFlowMonitorHelper::EndpointNodes ());	//n0 and the nodes it sends to
+	else
+	{
+		NodeContainer probed;
+		stringstream ss (monitor);
+		string item;
+		while (getline (ss, item, ','))
+		{
+			uint32_t id = atoi (item.c_str ());
+			if (id >= nodes.GetN ())
+			{
+				cout << "There is no node " << item << endl;
+				exit (1);
+			}
+			probed.Add (nodes.Get (id));
+		}
+		mon = flowmonhelper.InstallSelected (probed);
+	}
 	mon->Start (Seconds (0.5));		
 
 	//call the LossCalculator function every 0.05 sec. Required for plotting loss vs. time graph
@@ -312,9 +564,38 @@ int main(int argc, char *argv[])
 	cout << "Total lost packets (destined to node2) =  " << lostPckts << "\n"; 
 	cout << "Packets Lost Percentage (totalLost/totalTranmitted) [destined to node2]: " << ((lostPckts * 100) / transmittedPckts) << "%" << "\n"; 
 	cout<<"\n\n----------------------------------\n\n";	
+	//Per event table, only for a schedule file: the recomputation times depend on the machine
+	if (!failureFile.empty ())
+	{
+		cout << "Failure schedule:\n";
+		cout << "    Time  Node  If  Event  Recompute (ms)     Drops  Reconverged after (s)\n";
+		for (uint32_t i = 0; i < failures.size (); ++i)
+		{
+			const FailureEvent &e = failures[i];
+			cout << fixed << setprecision (3) << setw (8) << e.time << setw (6) << e.node << setw (4) << e.interface
+			     << setw (7) << (e.up ? "up" : "down") << setw (16) << e.recomputeMs << setw (10) << e.drops
+			     << setw (23) << e.lastDrop - e.time << "\n";
+		}
+		cout.unsetf (ios::floatfield);
+		cout << "\n----------------------------------\n\n";
+	}
+	//probe work of the --monitor profile, to compare with --monitor=all
+	flowmonhelper.PrintOverhead (cout);
+	cout << "\n----------------------------------\n\n";
+	if (hopDelays)
+	{
+		hopLatency.Print (cout);
+		cout << "\n----------------------------------\n\n";
+	}
+	if (recorder)
+	{
+		cout << "Flight recorder: " << recorder->GetTriggers () << " triggers, wrote " << recorder->GetWritten ()
+		     << " of " << recorder->GetSeen () << " packets seen\n";
+	}
 	mon->SerializeToXmlFile("assign-2.flowmon", true, true);
 
 	  Simulator::Destroy ();
+	  delete recorder;
 	  NS_LOG_INFO ("Done.");
 
 
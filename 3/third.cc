@@ -7,12 +7,25 @@
  */
 
 #include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <cstdlib>
 #include "ns3/core-module.h"
 #include "ns3/network-module.h"
 #include "ns3/internet-module.h"
 #include "ns3/point-to-point-module.h"
 #include "ns3/applications-module.h"
 #include "ns3/flow-monitor-module.h"
+#include "../common/trace-decimator.h"
+#include "../common/trace-writer.h"
+#include "../common/lab-log.h"
+#include "../common/latency-histogram.h"
+#include "../common/worker-pool.h"
+#include "../common/counting-scheduler.h"
+#include "../common/hash-flow-monitor.h"
 
 using namespace ns3;
 using namespace std;
@@ -55,14 +68,208 @@ NS_LOG_COMPONENT_DEFINE ("Lab4-3");
 // ===========================================================================
 
 
-ofstream cwnd[5]; // Congestion Windows filestream
-ofstream queueFile; // Queue size filestream
-ofstream recvfile[5]; // Receiver Rates filesteam
+ColumnTraceWriter columnTrace; // third.col, with --traceFormat=binary; outlives traceWriter
+TraceWriter traceWriter; // All trace files are written through this
+int cwnd[5]; // Congestion Windows trace streams
+int queueFile; // Queue size trace stream
+int recvfile[5]; // Receiver Rates trace streams
 int packetCount=0; //Current Packet Count
 int totalLength=0; 
 int packetSize[10];
 int sumPacketSize,queueSize;
 double initialTime[10],finalTime,diffTime;
+// Decide which trace events are written; see --decimate
+TraceDecimator cwndDecimator[5], queueDecimator[3], recvDecimator[5]; // queue: one per QueueEvent
+bool writeTraces = true; // No trace files are written when comparing runs
+bool hashClassifier = false; // --classifier=hash
+
+// Packets waiting in the node 0 queue, oldest first, with their enqueue time in
+// ns. All the queues offered by --queue are FIFOs, so a packet leaves either
+// at the head (dequeue, head drop) or right after it entered (tail drop).
+struct QueuedPacket
+{
+  uint64_t uid;
+  int64_t time;
+};
+deque<QueuedPacket> queuedPackets;
+LatencyHistogram queueDelay; // Time spent in the node 0 queue, ns
+uint64_t queueDrops = 0;
+// Packets in the node 0 queue integrated over time, for the mean occupancy
+double occupancyIntegral = 0;
+double occupancyLastChange = 0;
+size_t occupancyMax = 0;
+
+// Called before every change of queuedPackets
+static void
+UpdateOccupancy ()
+{
+  double now = Simulator::Now ().GetSeconds ();
+  occupancyIntegral += queuedPackets.size () * (now - occupancyLastChange);
+  occupancyLastChange = now;
+}
+
+/**
+ * Fixed size in-memory recorder of the TCP state of one flow.
+ * Every change of a TCP trace source is stored as (time, source, value) in a
+ * ring buffer that is allocated once; when it is full the oldest samples are
+ * overwritten. Nothing touches the disk until Dump() is called, either at
+ * the times given with --telemetryDump or at the end of the simulation.
+ */
+class TelemetryRecorder
+{
+public:
+  enum Source
+  {
+    CWND,
+    SSTHRESH,
+    RTT,
+    RTO,
+    BYTES_IN_FLIGHT,
+    SOURCE_COUNT
+  };
+
+  TelemetryRecorder (string fileName, uint32_t capacity)
+    : m_fileName (fileName),
+      m_samples (capacity > 0 ? capacity : 1),
+      m_head (0),
+      m_count (0),
+      m_overwritten (0),
+      m_dumps (0)
+  {
+  }
+
+  void Record (Source source, uint64_t value)
+  {
+    Sample &s = m_samples[m_head];
+    s.time = Simulator::Now ().GetNanoSeconds ();
+    s.value = value;
+    s.source = source;
+    m_head = (m_head + 1) % m_samples.size ();
+    if (m_count < m_samples.size ())
+      {
+        m_count++;
+      }
+    else
+      {
+        m_overwritten++;
+      }
+  }
+
+  // Appends the buffered samples, oldest first, to the file and empties the buffer
+  void Dump ()
+  {
+    static const char *names[SOURCE_COUNT] = { "cwnd", "ssthresh", "rtt", "rto", "inflight" };
+    ofstream out (m_fileName.c_str (), m_dumps == 0 ? ios::out : ios::app);
+    if (m_dumps == 0)
+      {
+        out << "# time(s) source value (bytes, or seconds for rtt/rto)" << endl;
+      }
+    if (m_overwritten > 0)
+      {
+        out << "# " << m_overwritten << " older samples were overwritten" << endl;
+      }
+    uint32_t first = (m_head + m_samples.size () - m_count) % m_samples.size ();
+    for (uint32_t i = 0; i < m_count; ++i)
+      {
+        const Sample &s = m_samples[(first + i) % m_samples.size ()];
+        out << s.time / 1e9 << " " << names[s.source] << " ";
+        if (s.source == RTT || s.source == RTO)
+          {
+            out << s.value / 1e9 << "\n";
+          }
+        else
+          {
+            out << s.value << "\n";
+          }
+      }
+    out.close ();
+    m_count = 0;
+    m_overwritten = 0;
+    m_dumps++;
+  }
+
+private:
+  struct Sample
+  {
+    int64_t time;   // ns
+    uint64_t value; // bytes, or ns for RTT and RTO
+    uint8_t source;
+  };
+
+  string m_fileName;
+  vector<Sample> m_samples;
+  uint32_t m_head;
+  uint32_t m_count;
+  uint64_t m_overwritten;
+  uint32_t m_dumps;
+};
+
+TelemetryRecorder *telemetry[5]; // Per flow TCP state recorders, if enabled
+
+static void
+TelemetryCwnd (TelemetryRecorder *recorder, uint32_t oldval, uint32_t newval)
+{
+  recorder->Record (TelemetryRecorder::CWND, newval);
+}
+
+static void
+TelemetrySsThresh (TelemetryRecorder *recorder, uint32_t oldval, uint32_t newval)
+{
+  recorder->Record (TelemetryRecorder::SSTHRESH, newval);
+}
+
+static void
+TelemetryRtt (TelemetryRecorder *recorder, Time oldval, Time newval)
+{
+  recorder->Record (TelemetryRecorder::RTT, newval.GetNanoSeconds ());
+}
+
+static void
+TelemetryRto (TelemetryRecorder *recorder, Time oldval, Time newval)
+{
+  recorder->Record (TelemetryRecorder::RTO, newval.GetNanoSeconds ());
+}
+
+static void
+TelemetryBytesInFlight (TelemetryRecorder *recorder, uint32_t oldval, uint32_t newval)
+{
+  recorder->Record (TelemetryRecorder::BYTES_IN_FLIGHT, newval);
+}
+
+/**
+ * Hooks every TCP state trace source of the socket to the recorder.
+ * Not every ns-3 release has all of them (BytesInFlight and
+ * SlowStartThreshold are missing from older ones), so missing sources are
+ * only reported once.
+ */
+static void
+AttachTelemetry (Ptr<Socket> socket, TelemetryRecorder *recorder)
+{
+  static bool reported = false;
+  bool ok = true;
+  ok &= socket->TraceConnectWithoutContext ("CongestionWindow", MakeBoundCallback (&TelemetryCwnd, recorder));
+  ok &= socket->TraceConnectWithoutContext ("SlowStartThreshold", MakeBoundCallback (&TelemetrySsThresh, recorder));
+  ok &= socket->TraceConnectWithoutContext ("RTT", MakeBoundCallback (&TelemetryRtt, recorder));
+  ok &= socket->TraceConnectWithoutContext ("RTO", MakeBoundCallback (&TelemetryRto, recorder));
+  ok &= socket->TraceConnectWithoutContext ("BytesInFlight", MakeBoundCallback (&TelemetryBytesInFlight, recorder));
+  if (!ok && !reported)
+    {
+      NS_LOG_UNCOND ("Some TCP trace sources are not available in this ns-3 release; they are not recorded");
+      reported = true;
+    }
+}
+
+static void
+DumpTelemetry ()
+{
+  for (int i = 0; i < 5; ++i)
+    {
+      if (telemetry[i])
+        {
+          telemetry[i]->Dump ();
+        }
+    }
+}
 
 /**
  * Class which will act as a tcp source. We will hook a congestion tracer with its tcp connection.
@@ -161,37 +368,82 @@ MyApp::ScheduleTx (void)
 }
 
 
+/**
+ * Formatters of the trace files; run on the trace writer thread when
+ * --asyncTrace is on
+ */
+enum QueueEvent
+{
+  QUEUE_EQ,
+  QUEUE_DQ,
+  QUEUE_DR
+};
+
+static void
+FormatCwnd (ostream &os, const TraceRecord &r)
+{
+  os<<r.time<<" "<<r.integer<<"\n";
+}
+
+static void
+FormatQueue (ostream &os, const TraceRecord &r)
+{
+  static const char *events[] = { "EQ", "DQ", "DR" };
+  os<<r.time<<"\t "<<events[r.tag]<<" \t"<<r.integer<<"\n";
+}
+
+static void
+FormatRecv (ostream &os, const TraceRecord &r)
+{
+  os<<r.time<<"\t"<<r.integer<<"\n";
+}
+
 /**
  * Following 5 functions are congestion windows hooks for each of the tcp connections
  */
 static void
 CwndTracer1(uint32_t oldval, uint32_t newval)
 {
-  cwnd[0]<<Simulator::Now().GetSeconds()<<" "<<newval<<endl;
+  if (writeTraces && cwndDecimator[0].Accept (Simulator::Now ().GetSeconds (), newval))
+    {
+      traceWriter.WriteInt (cwnd[0], Simulator::Now ().GetSeconds (), newval);
+    }
 }
 
 static void
 CwndTracer2(uint32_t oldval, uint32_t newval)
 {
-  cwnd[1]<<Simulator::Now().GetSeconds()<<" "<<newval<<endl;
+  if (writeTraces && cwndDecimator[1].Accept (Simulator::Now ().GetSeconds (), newval))
+    {
+      traceWriter.WriteInt (cwnd[1], Simulator::Now ().GetSeconds (), newval);
+    }
 }
 
 static void
 CwndTracer3(uint32_t oldval, uint32_t newval)
 {
-  cwnd[2]<<Simulator::Now().GetSeconds()<<" "<<newval<<endl;
+  if (writeTraces && cwndDecimator[2].Accept (Simulator::Now ().GetSeconds (), newval))
+    {
+      traceWriter.WriteInt (cwnd[2], Simulator::Now ().GetSeconds (), newval);
+    }
 }
 
 static void
 CwndTracer4(uint32_t oldval, uint32_t newval)
 {
-  cwnd[3]<<Simulator::Now().GetSeconds()<<" "<<newval<<endl;
+  if (writeTraces && cwndDecimator[3].Accept (Simulator::Now ().GetSeconds (), newval))
+    {
+      traceWriter.WriteInt (cwnd[3], Simulator::Now ().GetSeconds (), newval);
+    }
 }
 
 static void
 CwndTracer5(uint32_t oldval, uint32_t newval)
 {
-  cwnd[4]<<Simulator::Now().GetSeconds()<<" "<<newval<<endl;
+  if (writeTraces && cwndDecimator[4].Accept (Simulator::Now ().GetSeconds (), newval))
+    {
+      traceWriter.WriteInt (cwnd[4], Simulator::Now ().GetSeconds (), newval);
+    }
 }
 
 /**
@@ -201,7 +453,14 @@ static void
 Enqueue(string context, Ptr<const Packet> p)
 {
   queueSize++;
-  queueFile<<Simulator::Now ().GetSeconds()<<"\t EQ \t"<<queueSize<<endl;
+  UpdateOccupancy ();
+  QueuedPacket queued = { p->GetUid (), Simulator::Now ().GetNanoSeconds () };
+  queuedPackets.push_back (queued);
+  occupancyMax = max (occupancyMax, queuedPackets.size ());
+  if (writeTraces && queueDecimator[QUEUE_EQ].Accept (Simulator::Now ().GetSeconds (), queueSize))
+    {
+      traceWriter.WriteInt (queueFile, Simulator::Now ().GetSeconds (), queueSize, QUEUE_EQ);
+    }
 }
 
 /**
@@ -211,14 +470,38 @@ static void
 Dequeue(string context, Ptr<const Packet> p)
 {
   queueSize--;
-  queueFile<<Simulator::Now ().GetSeconds()<<"\t DQ \t"<<queueSize<<endl;
+  UpdateOccupancy ();
+  if (!queuedPackets.empty () && queuedPackets.front ().uid == p->GetUid ())
+    {
+      queueDelay.Record (Simulator::Now ().GetNanoSeconds () - queuedPackets.front ().time);
+      queuedPackets.pop_front ();
+    }
+  if (writeTraces && queueDecimator[QUEUE_DQ].Accept (Simulator::Now ().GetSeconds (), queueSize))
+    {
+      traceWriter.WriteInt (queueFile, Simulator::Now ().GetSeconds (), queueSize, QUEUE_DQ);
+    }
 
 }
 
 static void
 Drop(string context, Ptr<const Packet> p)
 {
-  queueFile<<Simulator::Now ().GetSeconds()<<"\t DR \t"<<queueSize<<endl;
+  queueDrops++;
+  UpdateOccupancy ();
+  if (!queuedPackets.empty () && queuedPackets.back ().uid == p->GetUid ())
+    {
+      queuedPackets.pop_back ();
+    }
+  else if (!queuedPackets.empty () && queuedPackets.front ().uid == p->GetUid ())
+    {
+      queuedPackets.pop_front ();
+    }
+  // Judged on the drop count: with 'change', a drop at the same queue size
+  // as the last one is still news
+  if (writeTraces && queueDecimator[QUEUE_DR].Accept (Simulator::Now ().GetSeconds (), queueDrops))
+    {
+      traceWriter.WriteInt (queueFile, Simulator::Now ().GetSeconds (), queueSize, QUEUE_DR);
+    }
 }
 
 
@@ -245,23 +528,11 @@ ReceivePacket (string context, Ptr<const Packet> p, const Address& addr)
 
                 totalLength=sumPacketSize/diffTime;
 
-
-              switch(currentPacketPort){
-                case 49153:                
-                  recvfile[0]<<finalTime<<"\t"<<totalLength<<endl;
-                  break;
-                case 49154:                
-                  recvfile[1]<<finalTime<<"\t"<<totalLength<<endl;
-                  break;
-                 case 49155:                
-                  recvfile[2]<<finalTime<<"\t"<<totalLength<<endl;
-                  break;
-                case 49156:                
-                  recvfile[3]<<finalTime<<"\t"<<totalLength<<endl;
-                  break;
-                case 49157:                
-                  recvfile[4]<<finalTime<<"\t"<<totalLength<<endl;
-                  break;
+              // Source ports 49153..49157 are the flows 0..4
+              int flow = currentPacketPort - 49153;
+              if (writeTraces && flow >= 0 && flow < 5 && recvDecimator[flow].Accept (finalTime, totalLength))
+              {
+                traceWriter.WriteInt (recvfile[flow], finalTime, totalLength);
               }
                         
                 initialTime[packetCount%10]=finalTime;
@@ -270,50 +541,122 @@ ReceivePacket (string context, Ptr<const Packet> p, const Address& addr)
 }
 
 
-int 
-main (int argc, char *argv[])
+/**
+ * One run of the five flow scenario and what is reported about it
+ */
+struct Scenario
 {
+  string queue;   // 'DropTail', 'RED' or 'CoDel'
+  string tcpType; // 'NewReno', 'Tahoe', ...
+  string scheduler; // 'map', 'heap', ...; does not change the results
+};
 
-  /**
-   * File Input Output Code
-   */
-  string fileprefix = "Cwnd";
-  string recvprefix = "Recv";
-  for (int i = 0; i < 5; ++i)
-  {
-    stringstream ss;
-    ss << i;
-    string str = ss.str();
-    string filename = fileprefix + str + ".dat";
-    cwnd[i].open(filename.c_str());
+struct ScenarioResult
+{
+  uint16_t sourcePort[5];
+  uint64_t txBytes[5];
+  uint64_t rxBytes[5];
+  double throughput[5]; // Mbps
+  uint64_t drops;       // at the node 0 queue
+  double occupancyMean; // packets in the node 0 queue
+  uint32_t occupancyMax;
+  double delay50;       // queueing delay at node 0, ms
+  double delay99;
+  double delayMax;
+  uint64_t events;      // executed by the simulator
+  double wallSeconds;   // spent in Simulator::Run ()
+};
 
-    
-     filename = recvprefix + str + ".dat";
-    recvfile[i].open(filename.c_str());
-  }
-  queueFile.open("queue.dat");
+/**
+ * The node 0 queue. Every discipline holds at most 1000 packets, like the
+ * DropTailQueue the lab was written with, so only the discipline differs.
+ * FqCoDel and PIE are queue discs of the traffic-control layer, which this
+ * ns-3 release does not have.
+ */
+static bool
+IsQueueSupported (const string &queue)
+{
+  TypeId tid;
+  return (queue == "DropTail" && TypeId::LookupByNameFailSafe ("ns3::DropTailQueue", &tid))
+    || (queue == "RED" && TypeId::LookupByNameFailSafe ("ns3::RedQueue", &tid))
+    || (queue == "CoDel" && TypeId::LookupByNameFailSafe ("ns3::CoDelQueue", &tid));
+}
 
+/**
+ * Only the variants this ns-3 release provides can be run (NewReno, Reno,
+ * Tahoe, Rfc793 and, from ns-3.14 on, Westwood); Cubic, BBR and Vegas came
+ * with later releases.
+ */
+static bool
+IsTcpSupported (const string &tcpType)
+{
+  TypeId tid;
+  return !tcpType.empty () && TypeId::LookupByNameFailSafe ("ns3::Tcp" + tcpType, &tid);
+}
 
-  /**
-   * Preparing the simulator
-   */
-  Config::SetDefault ("ns3::WifiRemoteStationManager::FragmentationThreshold", StringValue ("2200"));
-  Config::SetDefault ("ns3::WifiRemoteStationManager::RtsCtsThreshold", StringValue ("2200"));
-  // Set the size of the sending queue
-  Config::SetDefault ("ns3::DropTailQueue::MaxPackets", UintegerValue(uint32_t(1000)));
-  
-  // Uncomment the below statement to enable logging
-  //LogComponentEnable("Lab4-3", LOG_LEVEL_INFO); 
-  
-  std::string tcpType = "NewReno";
+/**
+ * Jain's fairness index of the flow throughputs: 1 if all flows got the same
+ * share, 1/n if one flow got everything.
+ */
+static double
+JainFairness (const double *throughput, int n)
+{
+  double sum = 0;
+  double squares = 0;
+  for (int i = 0; i < n; ++i)
+  {
+    sum += throughput[i];
+    squares += throughput[i] * throughput[i];
+  }
+  return squares > 0 ? sum * sum / (n * squares) : 0;
+}
 
-  // Command Line parsing
-  CommandLine cmd;
-  cmd.AddValue ("Tcp", "Tcp type: 'NewReno' or 'Tahoe'", tcpType);
-  cmd.Parse (argc, argv);
+static void
+SetBottleneckQueue (PointToPointHelper &pointToPoint, const string &queue)
+{
+  if (queue == "RED")
+  {
+    pointToPoint.SetQueue ("ns3::RedQueue",
+                           "Mode", StringValue ("QUEUE_MODE_PACKETS"),
+                           "QueueLimit", UintegerValue (1000),
+                           "LinkBandwidth", DataRateValue (DataRate ("10Mbps")),
+                           "LinkDelay", TimeValue (Time ("10ms")));
+  }
+  else if (queue == "CoDel")
+  {
+    pointToPoint.SetQueue ("ns3::CoDelQueue",
+                           "Mode", StringValue ("QUEUE_MODE_PACKETS"),
+                           "MaxPackets", UintegerValue (1000));
+  }
+  else
+  {
+    pointToPoint.SetQueue("ns3::DropTailQueue","MaxPackets",UintegerValue(1000));
+  }
+}
 
+/**
+ * Builds the five flow topology with the given bottleneck queue and TCP and
+ * runs it for 50s. The caller destroys the simulator, so anything scheduled
+ * for destruction (the trace writer) runs after the results are printed.
+ */
+static ScenarioResult
+RunScenario (const Scenario &scenario)
+{
   // Set the TCP Socket Type
-  Config::SetDefault ("ns3::TcpL4Protocol::SocketType", TypeIdValue(TypeId::LookupByName ("ns3::Tcp" + tcpType)));
+  Config::SetDefault ("ns3::TcpL4Protocol::SocketType", TypeIdValue(TypeId::LookupByName ("ns3::Tcp" + scenario.tcpType)));
+
+  string schedulerType;
+  SchedulerTypeName (scenario.scheduler, schedulerType);
+  UseCountingScheduler (schedulerType);
+
+  queueSize = 0;
+  packetCount = 0;
+  queuedPackets.clear ();
+  queueDelay.Reset ();
+  queueDrops = 0;
+  occupancyIntegral = 0;
+  occupancyLastChange = 0;
+  occupancyMax = 0;
 
   NS_LOG_INFO ("Creating Topology");
 
@@ -323,7 +666,7 @@ main (int argc, char *argv[])
   PointToPointHelper pointToPoint;
   pointToPoint.SetDeviceAttribute("DataRate", DataRateValue(DataRate("10Mbps")));
   pointToPoint.SetChannelAttribute("Delay", TimeValue(Time("10ms")));
-  pointToPoint.SetQueue("ns3::DropTailQueue","MaxPackets",UintegerValue(1000));
+  SetBottleneckQueue (pointToPoint, scenario.queue);
 
   NetDeviceContainer devices;
   devices = pointToPoint.Install (nodes);
@@ -352,6 +695,10 @@ main (int argc, char *argv[])
   Address sinkAddress (InetSocketAddress(interfaces.GetAddress (1), sinkPort));
   Ptr<Socket> ns3TcpSocket = Socket::CreateSocket (nodes.Get (0), TcpSocketFactory::GetTypeId ());
   ns3TcpSocket->TraceConnectWithoutContext ("CongestionWindow", MakeCallback (&CwndTracer1));
+  if (telemetry[0])
+  {
+    AttachTelemetry (ns3TcpSocket, telemetry[0]);
+  }
   Ptr<MyApp> app = CreateObject<MyApp> ();
   app->Setup (ns3TcpSocket, sinkAddress, 2000, DataRate ("1.5Mbps"));
   nodes.Get (0)->AddApplication (app);
@@ -363,6 +710,10 @@ main (int argc, char *argv[])
   Address sinkAddress1 (InetSocketAddress(interfaces.GetAddress (1), sinkPort+1));
   Ptr<Socket> ns3TcpSocket2 = Socket::CreateSocket (nodes.Get (0), TcpSocketFactory::GetTypeId ());
   ns3TcpSocket2->TraceConnectWithoutContext ("CongestionWindow", MakeCallback (&CwndTracer2));
+  if (telemetry[1])
+  {
+    AttachTelemetry (ns3TcpSocket2, telemetry[1]);
+  }
   Ptr<MyApp> app2 = CreateObject<MyApp> ();
   app2->Setup (ns3TcpSocket2, sinkAddress1, 2000, DataRate ("1.5Mbps"));
   nodes.Get (0)->AddApplication (app2);
@@ -374,6 +725,10 @@ main (int argc, char *argv[])
   Address sinkAddress2 (InetSocketAddress(interfaces.GetAddress (1), sinkPort+2));
   Ptr<Socket> ns3TcpSocket3 = Socket::CreateSocket (nodes.Get (0), TcpSocketFactory::GetTypeId ());
   ns3TcpSocket3->TraceConnectWithoutContext ("CongestionWindow", MakeCallback (&CwndTracer3));
+  if (telemetry[2])
+  {
+    AttachTelemetry (ns3TcpSocket3, telemetry[2]);
+  }
   Ptr<MyApp> app3 = CreateObject<MyApp> ();
   app3->Setup (ns3TcpSocket3, sinkAddress2, 2000, DataRate ("1.5Mbps"));
   nodes.Get (0)->AddApplication (app3);
@@ -384,6 +739,10 @@ main (int argc, char *argv[])
   Address sinkAddress3 (InetSocketAddress(interfaces.GetAddress (1), sinkPort+3));
   Ptr<Socket> ns3TcpSocket4 = Socket::CreateSocket (nodes.Get (0), TcpSocketFactory::GetTypeId ());
   ns3TcpSocket4->TraceConnectWithoutContext ("CongestionWindow", MakeCallback (&CwndTracer4));
+  if (telemetry[3])
+  {
+    AttachTelemetry (ns3TcpSocket4, telemetry[3]);
+  }
   Ptr<MyApp> app4 = CreateObject<MyApp> ();
   app4->Setup (ns3TcpSocket4, sinkAddress3, 2000, DataRate ("1.5Mbps"));
   nodes.Get (0)->AddApplication (app4);
@@ -394,6 +753,10 @@ main (int argc, char *argv[])
   Address sinkAddress4 (InetSocketAddress(interfaces.GetAddress (1), sinkPort+4));
   Ptr<Socket> ns3TcpSocket5 = Socket::CreateSocket (nodes.Get (0), TcpSocketFactory::GetTypeId ());
   ns3TcpSocket5->TraceConnectWithoutContext ("CongestionWindow", MakeCallback (&CwndTracer5));
+  if (telemetry[4])
+  {
+    AttachTelemetry (ns3TcpSocket5, telemetry[4]);
+  }
   Ptr<MyApp> app5 = CreateObject<MyApp> ();
   app5->Setup (ns3TcpSocket5, sinkAddress4, 2000, DataRate ("1.5Mbps"));
   nodes.Get (0)->AddApplication (app5);
@@ -412,43 +775,467 @@ main (int argc, char *argv[])
   context = "/NodeList/1/ApplicationList/*/$ns3::PacketSink/Rx";
   Config::Connect (context, MakeCallback(&ReceivePacket));
   
-  AsciiTraceHelper ascii;
-  pointToPoint.EnableAsciiAll (ascii.CreateFileStream ("lab4-3.tr"));
-  pointToPoint.EnablePcapAll("lab4-3", false);
+  if (writeTraces)
+  {
+    AsciiTraceHelper ascii;
+    pointToPoint.EnableAsciiAll (ascii.CreateFileStream ("lab4-3.tr"));
+    pointToPoint.EnablePcapAll("lab4-3", false);
+  }
 
-  FlowMonitorHelper flowmon;
+  HashFlowMonitorHelper flowmon (hashClassifier);
   Ptr<FlowMonitor> monitor = flowmon.InstallAll();  
 
   Simulator::Stop (Seconds(50));
+  SystemWallClockMs wallClock;
+  wallClock.Start ();
   Simulator::Run ();
+  double wallSeconds = wallClock.End () / 1000.0;
 
   // Flowmonitor Analysis
   monitor->CheckForLostPackets ();
 
+  ScenarioResult result;
+  for (int i = 0; i < 5; ++i)
+  {
+    result.sourcePort[i] = 0;
+    result.txBytes[i] = 0;
+    result.rxBytes[i] = 0;
+    result.throughput[i] = 0;
+  }
   Ptr<Ipv4FlowClassifier> classifier = DynamicCast<Ipv4FlowClassifier> (flowmon.GetClassifier ());
-    std::map<FlowId, FlowMonitor::FlowStats> stats = monitor->GetFlowStats ();
-    for (std::map<FlowId, FlowMonitor::FlowStats>::const_iterator i = stats.begin (); i != stats.end (); ++i)
+  std::map<FlowId, FlowMonitor::FlowStats> stats = monitor->GetFlowStats ();
+  for (std::map<FlowId, FlowMonitor::FlowStats>::const_iterator i = stats.begin (); i != stats.end (); ++i)
+  {
+    Ipv4FlowClassifier::FiveTuple t = classifier->FindFlow (i->first);
+    // Sink ports 9000..9004 are the flows 0..4
+    int flow = t.destinationPort - sinkPort;
+    if (t.sourceAddress == "172.16.24.1" && t.destinationAddress == "172.16.24.2" && flow >= 0 && flow < 5)
+    {
+      result.sourcePort[flow] = t.sourcePort;
+      result.txBytes[flow] = i->second.txBytes;
+      result.rxBytes[flow] = i->second.rxBytes;
+      result.throughput[flow] = i->second.rxBytes * 8.0 / (i->second.timeLastRxPacket.GetSeconds() - i->second.timeFirstTxPacket.GetSeconds())/1024/1024;
+    }
+  }
+  result.drops = queueDrops;
+  UpdateOccupancy ();
+  result.occupancyMean = occupancyIntegral / Simulator::Now ().GetSeconds ();
+  result.occupancyMax = static_cast<uint32_t> (occupancyMax);
+  result.delay50 = queueDelay.ValueAtPercentile (50) / 1e6;
+  result.delay99 = queueDelay.ValueAtPercentile (99) / 1e6;
+  result.delayMax = queueDelay.GetMax () / 1e6;
+  result.events = CountingScheduler::GetExecuted ();
+  result.wallSeconds = wallSeconds;
+  return result;
+}
+
+
+// One line per scenario, as sent back by the comparison workers
+static string
+FormatScenarioResult (const ScenarioResult &result)
+{
+  ostringstream os;
+  for (int i = 0; i < 5; ++i)
+  {
+    os << result.throughput[i] << " ";
+  }
+  os << result.drops << " " << result.delay50 << " " << result.delay99 << " " << result.delayMax
+     << " " << result.occupancyMean << " " << result.occupancyMax
+     << " " << result.events << " " << result.wallSeconds << "\n";
+  return os.str ();
+}
+
+static bool
+ParseScenarioResult (const string &record, ScenarioResult &result)
+{
+  istringstream is (record);
+  for (int i = 0; i < 5; ++i)
+  {
+    if (!(is >> result.throughput[i]))
+    {
+      return false;
+    }
+  }
+  if (!(is >> result.drops >> result.delay50 >> result.delay99 >> result.delayMax
+           >> result.occupancyMean >> result.occupancyMax >> result.events >> result.wallSeconds))
+  {
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Runs every scenario (queue, TCP variant and scheduler) in a worker of its
+ * own and prints them side by side
+ */
+class ComparisonTask : public WorkerTask
+{
+public:
+  ComparisonTask (const vector<Scenario> &scenarios)
+    : m_scenarios (scenarios),
+      m_results (scenarios.size ()),
+      m_done (scenarios.size (), false)
+  {
+  }
+
+  virtual string Run (uint32_t index)
+  {
+    ScenarioResult result = RunScenario (m_scenarios[index]);
+    Simulator::Destroy ();
+    return FormatScenarioResult (result);
+  }
+
+  virtual void Collect (uint32_t index, const string &record)
+  {
+    m_done[index] = ParseScenarioResult (record, m_results[index]);
+  }
+
+  void PrintTable () const
+  {
+    cout << left << setw (10) << "Queue" << setw (10) << "Tcp" << setw (10) << "Sched" << right;
+    for (int i = 0; i < 5; ++i)
+    {
+      cout << setw (8) << "Flow" << i + 1;
+    }
+    cout << setw (10) << "Fairness" << setw (8) << "Drops" << setw (10) << "Qd p50" << setw (10) << "Qd p99"
+         << setw (10) << "Qd max" << setw (10) << "Qlen avg" << setw (10) << "Qlen max"
+         << setw (12) << "Events" << setw (12) << "Events/s" << "\n";
+    cout << left << setw (30) << "" << right << setw (45) << "throughput (Mbps)" << setw (10) << "(Jain)"
+         << setw (38) << "queueing delay (ms)" << setw (20) << "(packets)" << "\n";
+    for (size_t i = 0; i < m_scenarios.size (); ++i)
+    {
+      cout << left << setw (10) << m_scenarios[i].queue << setw (10) << m_scenarios[i].tcpType
+           << setw (10) << m_scenarios[i].scheduler << right;
+      if (!m_done[i])
       {
-      Ipv4FlowClassifier::FiveTuple t = classifier->FindFlow (i->first);
-        if ((t.sourceAddress=="172.16.24.1" && t.destinationAddress == "172.16.24.2"))
-        {
-            std::cout << "Flow " << (i->first)/2 + 1  << " (" << t.sourceAddress<<":"<<t.sourcePort << " -> " << t.destinationAddress <<":"<<t.destinationPort<< ")\n";
-            std::cout << "  Tx Bytes:   " << i->second.txBytes << "\n";
-            std::cout << "  Rx Bytes:   " << i->second.rxBytes << "\n";
-            std::cout << "  Throughput: " << i->second.rxBytes * 8.0 / (i->second.timeLastRxPacket.GetSeconds() - i->second.timeFirstTxPacket.GetSeconds())/1024/1024  << " Mbps\n";
-        }
-       }
+        cout << "failed\n";
+        continue;
+      }
+      const ScenarioResult &r = m_results[i];
+      cout << fixed << setprecision (3);
+      for (int j = 0; j < 5; ++j)
+      {
+        cout << setw (9) << r.throughput[j];
+      }
+      cout << setw (10) << JainFairness (r.throughput, 5) << setw (8) << r.drops
+           << setw (10) << r.delay50 << setw (10) << r.delay99 << setw (10) << r.delayMax
+           << setw (10) << r.occupancyMean << setw (10) << r.occupancyMax << setw (12) << r.events
+           << setw (12) << static_cast<uint64_t> (r.wallSeconds > 0 ? r.events / r.wallSeconds : 0) << "\n";
+      cout.unsetf (ios::floatfield);
+    }
+  }
+
+private:
+  const vector<Scenario> &m_scenarios;
+  vector<ScenarioResult> m_results;
+  vector<bool> m_done;
+};
+
+int 
+main (int argc, char *argv[])
+{
+
+  /**
+   * Preparing the simulator
+   */
+  Config::SetDefault ("ns3::WifiRemoteStationManager::FragmentationThreshold", StringValue ("2200"));
+  Config::SetDefault ("ns3::WifiRemoteStationManager::RtsCtsThreshold", StringValue ("2200"));
+  // Set the size of the sending queue
+  Config::SetDefault ("ns3::DropTailQueue::MaxPackets", UintegerValue(uint32_t(1000)));
+  
+  std::string tcpType = "NewReno";
+  bool enableTelemetry = false;
+  uint32_t telemetryCapacity = 65536;
+  std::string telemetryDump = "";
+  std::string decimate = "all";
+  bool asyncTrace = true;
+  std::string traceFormat = "text";
+  uint32_t verbosity = LAB_QUIET;
+  std::string queueType = "DropTail";
+  std::string scheduler = "map";
+  std::string classifier = "ordered";
+  uint32_t jobs = 0;
+  uint32_t decimateN = 10;
+  double decimateInterval = 0.01;
+
+  // Command Line parsing
+  CommandLine cmd;
+  cmd.AddValue ("Tcp", "Tcp type, e.g. 'NewReno', 'Tahoe', 'Reno', 'Westwood'; a comma separated list compares them", tcpType);
+  cmd.AddValue ("telemetry", "Record cwnd, ssthresh, RTT, RTO and bytes in flight per flow into Telemetry*.dat", enableTelemetry);
+  cmd.AddValue ("telemetryCapacity", "Samples kept in memory per flow", telemetryCapacity);
+  cmd.AddValue ("telemetryDump", "Comma separated times (s) at which the telemetry is written out, besides the end", telemetryDump);
+  cmd.AddValue ("traceFormat", "Trace file format: 'text' (*.dat) or 'binary' (third.col)", traceFormat);
+  cmd.AddValue ("asyncTrace", "Format and write trace files on a background thread", asyncTrace);
+  cmd.AddValue ("decimate", "Trace output decimation: 'all', 'nth', 'interval' or 'change'", decimate);
+  cmd.AddValue ("decimateN", "With --decimate=nth, write every N-th event", decimateN);
+  cmd.AddValue ("decimateInterval", "With --decimate=interval, seconds between written events", decimateInterval);
+  cmd.AddValue ("queue", "Node 0 queue: 'DropTail', 'RED' or 'CoDel'; a comma separated list compares them", queueType);
+  cmd.AddValue ("scheduler", "Event scheduler: 'map', 'heap', 'list', 'calendar' or 'dary'; a comma separated list or 'all' compares them", scheduler);
+  cmd.AddValue ("classifier", "FlowMonitor flow classifier: 'ordered' (Ipv4FlowClassifier) or 'hash'", classifier);
+  cmd.AddValue ("jobs", "Parallel workers when comparing (0 = one per core)", jobs);
+  cmd.AddValue ("verbosity", "0 quiet, 1 progress, 2 every packet (skews timing)", verbosity);
+  cmd.Parse (argc, argv);
+
+  EnableLabLogging (verbosity, "Lab4-3", 0);
+
+  if (classifier != "ordered" && classifier != "hash")
+  {
+    NS_LOG_UNCOND ("The classifier must be either 'ordered' or 'hash'.");
+    return 1;
+  }
+  hashClassifier = classifier == "hash";
+
+  vector<string> tcpTypes;
+  stringstream tcpList (tcpType);
+  string tcp;
+  while (getline (tcpList, tcp, ','))
+  {
+    if (!IsTcpSupported (tcp))
+    {
+      NS_LOG_UNCOND ("The Tcp type ns3::Tcp" << tcp << " is not available in this ns-3 release.");
+      return 1;
+    }
+    tcpTypes.push_back (tcp);
+  }
+  if (tcpTypes.empty ())
+  {
+    NS_LOG_UNCOND ("At least one Tcp type is needed.");
+    return 1;
+  }
+
+  vector<string> schedulers;
+  if (scheduler == "all")
+  {
+    scheduler = "";
+    for (uint32_t i = 0; SCHEDULER_NAMES[i]; ++i)
+    {
+      string typeName;
+      if (SchedulerTypeName (SCHEDULER_NAMES[i], typeName))
+      {
+        scheduler += (scheduler.empty () ? "" : ",") + string (SCHEDULER_NAMES[i]);
+      }
+    }
+  }
+  stringstream schedulerList (scheduler);
+  string name;
+  while (getline (schedulerList, name, ','))
+  {
+    string typeName;
+    if (!SchedulerTypeName (name, typeName))
+    {
+      NS_LOG_UNCOND ("The scheduler must be 'map', 'heap', 'list', 'calendar' or 'dary'.");
+      return 1;
+    }
+    schedulers.push_back (name);
+  }
+  if (schedulers.empty ())
+  {
+    NS_LOG_UNCOND ("The scheduler must be 'map', 'heap', 'list', 'calendar' or 'dary'.");
+    return 1;
+  }
+
+  // Every queue with every Tcp type and every scheduler
+  vector<Scenario> scenarios;
+  stringstream queueList (queueType);
+  string queue;
+  while (getline (queueList, queue, ','))
+  {
+    if (queue == "FqCoDel" || queue == "PIE")
+    {
+      NS_LOG_UNCOND ("The " << queue << " queue disc needs the traffic-control layer, which this ns-3 release does not have.");
+      return 1;
+    }
+    if (!IsQueueSupported (queue))
+    {
+      NS_LOG_UNCOND ("The queue must be 'DropTail', 'RED' or 'CoDel'.");
+      return 1;
+    }
+    for (size_t i = 0; i < tcpTypes.size (); ++i)
+    {
+      for (size_t j = 0; j < schedulers.size (); ++j)
+      {
+        Scenario scenario;
+        scenario.queue = queue;
+        scenario.tcpType = tcpTypes[i];
+        scenario.scheduler = schedulers[j];
+        scenarios.push_back (scenario);
+      }
+    }
+  }
+  if (scenarios.empty ())
+  {
+    NS_LOG_UNCOND ("The queue must be 'DropTail', 'RED' or 'CoDel'.");
+    return 1;
+  }
+
+  if (traceFormat != "text" && traceFormat != "binary")
+  {
+    NS_LOG_UNCOND ("The trace format must be either 'text' or 'binary'.");
+    return 1;
+  }
+
+  TraceDecimator::Mode decimateMode;
+  if (!TraceDecimator::ParseMode (decimate, decimateMode))
+  {
+    NS_LOG_UNCOND ("The decimation mode must be 'all', 'nth', 'interval' or 'change'.");
+    return 1;
+  }
+  for (int i = 0; i < 3; ++i)
+  {
+    queueDecimator[i].Configure (decimateMode, decimateN, decimateInterval);
+  }
+  for (int i = 0; i < 5; ++i)
+  {
+    cwndDecimator[i].Configure (decimateMode, decimateN, decimateInterval);
+    recvDecimator[i].Configure (decimateMode, decimateN, decimateInterval);
+  }
+
+  // Several queues or Tcp types: run each in a worker and print only the comparison table
+  if (scenarios.size () > 1)
+  {
+    if (enableTelemetry)
+    {
+      NS_LOG_UNCOND ("No telemetry or trace files are written when comparing runs.");
+    }
+    // Parallel runs share the cores and the caches, so their events/s
+    // would not be comparable
+    if (schedulers.size () > 1 && jobs != 1)
+    {
+      NS_LOG_UNCOND ("Comparing schedulers: running the scenarios one at a time (--jobs=1).");
+      jobs = 1;
+    }
+    writeTraces = false;
+    ComparisonTask task (scenarios);
+    vector<uint32_t> indices;
+    for (uint32_t i = 0; i < scenarios.size (); ++i)
+    {
+      indices.push_back (i);
+    }
+    RunWorkers (task, indices, jobs);
+    task.PrintTable ();
+    return 0;
+  }
+
+  /**
+   * File Input Output Code
+   * Text mode writes Cwnd*.dat, Recv*.dat and queue.dat; binary mode puts
+   * the same events into third.col (read it with tools/trace-export)
+   */
+  if (traceFormat == "binary")
+  {
+    if (!columnTrace.Open ("third.col"))
+    {
+      NS_LOG_UNCOND ("Cannot open the trace files");
+      return 1;
+    }
+    uint32_t cwndEvent = columnTrace.AddEvent ("cwnd");
+    uint32_t recvEvent = columnTrace.AddEvent ("recv");
+    // EQ, DQ and DR follow each other so that the QueueEvent tag selects them
+    uint32_t queueEvent = columnTrace.AddEvent ("EQ");
+    columnTrace.AddEvent ("DQ");
+    columnTrace.AddEvent ("DR");
+    for (int i = 0; i < 5; ++i)
+    {
+      cwnd[i] = traceWriter.AddColumnStream (&columnTrace, i, cwndEvent, false);
+      recvfile[i] = traceWriter.AddColumnStream (&columnTrace, i, recvEvent, false);
+    }
+    queueFile = traceWriter.AddColumnStream (&columnTrace, COLUMN_NO_FLOW, queueEvent, false);
+  }
+  else
+  {
+    string fileprefix = "Cwnd";
+    string recvprefix = "Recv";
+    for (int i = 0; i < 5; ++i)
+    {
+      stringstream ss;
+      ss << i;
+      string str = ss.str();
+      string filename = fileprefix + str + ".dat";
+      cwnd[i] = traceWriter.AddStream (filename, &FormatCwnd);
+
+      filename = recvprefix + str + ".dat";
+      recvfile[i] = traceWriter.AddStream (filename, &FormatRecv);
+      if (cwnd[i] < 0 || recvfile[i] < 0)
+      {
+        NS_LOG_UNCOND ("Cannot open the trace files");
+        return 1;
+      }
+    }
+    queueFile = traceWriter.AddStream ("queue.dat", &FormatQueue);
+    if (queueFile < 0)
+    {
+      NS_LOG_UNCOND ("Cannot open the trace files");
+      return 1;
+    }
+  }
+
+  // From here on the hooks only queue records; the files are flushed and
+  // closed when the simulator is destroyed
+  traceWriter.Start (asyncTrace);
+  Simulator::ScheduleDestroy (&TraceWriter::Stop, &traceWriter);
+
+  for (int i = 0; i < 5; ++i)
+  {
+    telemetry[i] = 0;
+    if (enableTelemetry)
+    {
+      stringstream ss;
+      ss << "Telemetry" << i << ".dat";
+      telemetry[i] = new TelemetryRecorder (ss.str (), telemetryCapacity);
+    }
+  }
+  if (enableTelemetry)
+  {
+    stringstream ss (telemetryDump);
+    string item;
+    while (getline (ss, item, ','))
+    {
+      Simulator::Schedule (Seconds (atof (item.c_str ())), &DumpTelemetry);
+    }
+  }
+
+  ScenarioResult result = RunScenario (scenarios[0]);
+
+  for (int i = 0; i < 5; ++i)
+  {
+    std::cout << "Flow " << i + 1  << " (172.16.24.1:" << result.sourcePort[i] << " -> 172.16.24.2:" << 9000 + i << ")\n";
+    std::cout << "  Tx Bytes:   " << result.txBytes[i] << "\n";
+    std::cout << "  Rx Bytes:   " << result.rxBytes[i] << "\n";
+    std::cout << "  Throughput: " << result.throughput[i] << " Mbps\n";
+  }
+  std::cout << "Queue " << scenarios[0].queue << ": " << result.drops << " drops, queueing delay p50 " << result.delay50
+            << " ms, p99 " << result.delay99 << " ms, max " << result.delayMax << " ms\n";
+  std::cout << "  Occupancy:  " << result.occupancyMean << " packets on average, " << result.occupancyMax
+            << " at most; Jain fairness of the flows " << JainFairness (result.throughput, 5) << "\n";
+  std::cout << "Scheduler " << scenarios[0].scheduler << ": " << result.events << " events in " << result.wallSeconds
+            << " s wall clock (" << static_cast<uint64_t> (result.wallSeconds > 0 ? result.events / result.wallSeconds : 0)
+            << " events/s)\n";
 
   Simulator::Destroy ();
 
+  if (decimateMode != TraceDecimator::ALL)
+  {
+    uint64_t seen = 0;
+    uint64_t passed = 0;
+    for (int i = 0; i < 3; ++i)
+    {
+      seen += queueDecimator[i].GetSeen ();
+      passed += queueDecimator[i].GetPassed ();
+    }
+    for (int i = 0; i < 5; ++i)
+    {
+      seen += cwndDecimator[i].GetSeen () + recvDecimator[i].GetSeen ();
+      passed += cwndDecimator[i].GetPassed () + recvDecimator[i].GetPassed ();
+    }
+    std::cout << "Trace decimation: wrote " << passed << " of " << seen << " events\n";
+  }
 
-  // Closing Down files.
+  // Whatever is still buffered goes out now
+  DumpTelemetry ();
   for (int i = 0; i < 5; ++i)
   {
-    cwnd[i].close();
-    recvfile[i].close();
+    delete telemetry[i];
   }
 
-  queueFile.close();
   return 0;
 }
\ No newline at end of file
@@ -31,12 +31,27 @@
 
 // The goal of this experiment is to find the relationship between
 // the propagation delay(RTT) and fairness in TCP NewReno
+//
+// With --senders=N the same question is asked of a dumbbell:
+//
+//   s0 --+                              +-- r0
+//   s1 --+-- n0 ------------------ n1 --+-- r1
+//   ...  |      shared bottleneck       |   ...
+//   sN-1-+                              +-- rM-1
+//
+// Sender i sends one TCP flow to receiver i % M. Every access link gets its
+// own delay (--delayMin/--delayMax/--delayDist), so the flows see different
+// RTTs on the same bottleneck. Instead of the plot files, the throughput of
+// every flow goes to dumbbell-flows.dat and aggregate and fairness statistics
+// are printed.
 
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <cassert>
 #include <cstdio>
+#include <vector>
+#include <algorithm>
 #include "ns3/core-module.h"
 #include "ns3/network-module.h"
 #include "ns3/csma-module.h"
@@ -51,6 +66,8 @@
 #include "ns3/point-to-point-remote-channel.h"
 #include "ns3/csma-net-device.h"
 #include "ns3/gnuplot.h"
+#include "../common/trace-decimator.h"
+#include "../common/lab-log.h"
 
 using namespace std;
 using namespace ns3;
@@ -129,16 +146,22 @@ public:
 // plot2.plt -> gnuplot for current throughput of link2 vs time elapsed
 Plotter plot1("plot1", "Current throughput vs Time elapsed", "Link1");
 Plotter plot2("plot2", "Current throughput vs Time elapsed", "Link2");
+// Decide which received packets become plot points; see --decimate
+TraceDecimator plot1Decimator, plot2Decimator;
 
 // ReceiveNode2Packet is triggered whenever a packet is received on n2
 // Updates node2BytesRcv and adds dataset in plot1
 void
 ReceiveNode2Packet (string context, Ptr<const Packet> p, const Address& addr)
 {
-  NS_LOG_INFO (context <<
+  LAB_PACKET_LOG (context <<
                  " Packet Received from Node 2 at " << Simulator::Now ().GetSeconds() << "from " << InetSocketAddress::ConvertFrom(addr).GetIpv4 ());
   node2BytesRcv += p->GetSize ();
-  plot1.addDataset(Simulator::Now ().GetSeconds() , (node2BytesRcv * 8 / 1000000) / Simulator::Now ().GetSeconds()  );
+  double throughput = (node2BytesRcv * 8 / 1000000) / Simulator::Now ().GetSeconds();
+  if (plot1Decimator.Accept (Simulator::Now ().GetSeconds(), throughput))
+    {
+      plot1.addDataset(Simulator::Now ().GetSeconds() , throughput);
+    }
 }
 
 // ReceiveNode3Packet is triggered whenever a packet is received on n3
@@ -146,11 +169,189 @@ ReceiveNode2Packet (string context, Ptr<const Packet> p, const Address& addr)
 void
 ReceiveNode3Packet (string context, Ptr<const Packet> p, const Address& addr)
 {
-  NS_LOG_INFO (context <<
+  LAB_PACKET_LOG (context <<
                  " Packet Received from Node 3 at " << Simulator::Now ().GetSeconds() << "from " << InetSocketAddress::ConvertFrom(addr).GetIpv4 ());
   
   node3BytesRcv += p->GetSize ();
-  plot2.addDataset(Simulator::Now ().GetSeconds() , (node3BytesRcv * 8 / 1000000) / Simulator::Now ().GetSeconds() );
+  double throughput = (node3BytesRcv * 8 / 1000000) / Simulator::Now ().GetSeconds();
+  if (plot2Decimator.Accept (Simulator::Now ().GetSeconds(), throughput))
+    {
+      plot2.addDataset(Simulator::Now ().GetSeconds() , throughput);
+    }
+}
+
+// Parameters of the dumbbell run
+struct DumbbellConfig
+{
+  uint32_t senders;
+  uint32_t receivers;
+  string accessRate;     // sender and receiver links
+  string bottleneckRate; // n0n1
+  string bottleneckDelay;
+  string sourceRate;     // OnOff rate of every sender
+  double delayMin;       // ms, delay of the sender access links
+  double delayMax;
+  string delayDist;      // 'even' or 'uniform'
+  double duration;
+};
+
+// Bytes received per flow, updated by the sink of that flow
+static vector<uint64_t> flowBytes;
+
+static void
+ReceiveFlowPacket (uint32_t flow, Ptr<const Packet> p, const Address &addr)
+{
+  flowBytes[flow] += p->GetSize ();
+}
+
+// Jain's fairness index: 1 if all flows got the same, 1/n if one got all
+static double
+JainIndex (const vector<double> &throughput)
+{
+  double sum = 0;
+  double squares = 0;
+  for (size_t i = 0; i < throughput.size (); ++i)
+    {
+      sum += throughput[i];
+      squares += throughput[i] * throughput[i];
+    }
+  return squares > 0 ? sum * sum / (throughput.size () * squares) : 0;
+}
+
+// Builds and runs the dumbbell. Everything is set up in loops over node and
+// device containers, sinks are hooked without Config paths and routes are
+// static (one default route per host, one aggregate route per router), so
+// setting up 10k flows stays linear in the number of flows.
+static int
+RunDumbbell (const DumbbellConfig &config)
+{
+  uint16_t port = 9000;
+
+  NodeContainer routers;
+  routers.Create (2);
+  NodeContainer senders;
+  senders.Create (config.senders);
+  NodeContainer receivers;
+  receivers.Create (config.receivers);
+
+  InternetStackHelper stack;
+  stack.Install (routers);
+  stack.Install (senders);
+  stack.Install (receivers);
+
+  PointToPointHelper link;
+  link.SetDeviceAttribute ("DataRate", DataRateValue (DataRate (config.bottleneckRate)));
+  link.SetChannelAttribute ("Delay", TimeValue (Time (config.bottleneckDelay)));
+  NetDeviceContainer bottleneck = link.Install (routers.Get (0), routers.Get (1));
+
+  Ipv4AddressHelper address;
+  address.SetBase ("10.1.0.0", "255.255.255.252");
+  Ipv4InterfaceContainer bottleneckIf = address.Assign (bottleneck);
+
+  // Sender access links, one /30 each out of 10.2.0.0/16 and up
+  Ptr<UniformRandomVariable> delayRng = CreateObject<UniformRandomVariable> ();
+  vector<double> senderDelay (config.senders);
+  link.SetDeviceAttribute ("DataRate", DataRateValue (DataRate (config.accessRate)));
+  address.SetBase ("10.2.0.0", "255.255.255.252");
+  Ipv4StaticRoutingHelper staticRouting;
+  for (uint32_t i = 0; i < config.senders; ++i)
+    {
+      if (config.delayDist == "uniform")
+        {
+          senderDelay[i] = delayRng->GetValue (config.delayMin, config.delayMax);
+        }
+      else
+        {
+          senderDelay[i] = config.senders > 1
+            ? config.delayMin + (config.delayMax - config.delayMin) * i / (config.senders - 1)
+            : config.delayMin;
+        }
+      link.SetChannelAttribute ("Delay", TimeValue (NanoSeconds (static_cast<int64_t> (senderDelay[i] * 1000000 + 0.5))));
+      NetDeviceContainer access = link.Install (senders.Get (i), routers.Get (0));
+      Ipv4InterfaceContainer accessIf = address.Assign (access);
+      address.NewNetwork ();
+      staticRouting.GetStaticRouting (senders.Get (i)->GetObject<Ipv4> ())
+        ->SetDefaultRoute (accessIf.GetAddress (1), 1);
+    }
+
+  // Receiver access links out of 10.128.0.0/16 and up
+  link.SetChannelAttribute ("Delay", TimeValue (Time ("10ms")));
+  address.SetBase ("10.128.0.0", "255.255.255.252");
+  vector<Ipv4Address> receiverAddress (config.receivers);
+  for (uint32_t j = 0; j < config.receivers; ++j)
+    {
+      NetDeviceContainer access = link.Install (receivers.Get (j), routers.Get (1));
+      Ipv4InterfaceContainer accessIf = address.Assign (access);
+      address.NewNetwork ();
+      receiverAddress[j] = accessIf.GetAddress (0);
+      staticRouting.GetStaticRouting (receivers.Get (j)->GetObject<Ipv4> ())
+        ->SetDefaultRoute (accessIf.GetAddress (1), 1);
+    }
+
+  // The routers reach the hosts behind the other router over the bottleneck;
+  // their own hosts are on directly connected /30s
+  staticRouting.GetStaticRouting (routers.Get (0)->GetObject<Ipv4> ())
+    ->AddNetworkRouteTo (Ipv4Address ("10.128.0.0"), Ipv4Mask ("255.128.0.0"), bottleneckIf.GetAddress (1), 1);
+  staticRouting.GetStaticRouting (routers.Get (1)->GetObject<Ipv4> ())
+    ->AddNetworkRouteTo (Ipv4Address ("10.0.0.0"), Ipv4Mask ("255.128.0.0"), bottleneckIf.GetAddress (0), 1);
+
+  // One OnOff source and one sink per flow; the sink of flow i listens on
+  // port 9000 + i / receivers of receiver i % receivers
+  flowBytes.assign (config.senders, 0);
+  ApplicationContainer apps;
+  OnOffHelper source ("ns3::TcpSocketFactory", Address ());
+  source.SetAttribute ("OnTime", StringValue ("ns3::ConstantRandomVariable[Constant=1e9]"));
+  source.SetAttribute ("OffTime", StringValue ("ns3::ConstantRandomVariable[Constant=0]"));
+  source.SetAttribute ("DataRate", DataRateValue (DataRate (config.sourceRate)));
+  source.SetAttribute ("PacketSize", UintegerValue (2000));
+  PacketSinkHelper sink ("ns3::TcpSocketFactory", Address ());
+  for (uint32_t i = 0; i < config.senders; ++i)
+    {
+      uint32_t j = i % config.receivers;
+      InetSocketAddress remote (receiverAddress[j], port + i / config.receivers);
+      source.SetAttribute ("Remote", AddressValue (remote));
+      apps.Add (source.Install (senders.Get (i)));
+
+      sink.SetAttribute ("Local", AddressValue (InetSocketAddress (Ipv4Address::GetAny (), port + i / config.receivers)));
+      ApplicationContainer sinkApp = sink.Install (receivers.Get (j));
+      sinkApp.Get (0)->TraceConnectWithoutContext ("Rx", MakeBoundCallback (&ReceiveFlowPacket, i));
+      apps.Add (sinkApp);
+    }
+  apps.Start (Seconds (0));
+  apps.Stop (Seconds (config.duration));
+
+  Simulator::Stop (Seconds (config.duration));
+  Simulator::Run ();
+  Simulator::Destroy ();
+
+  // Per flow throughput, also written out with the RTT of the flow
+  vector<double> throughput (config.senders);
+  double total = 0;
+  ofstream flowFile ("dumbbell-flows.dat");
+  flowFile << "# flow access-delay(ms) throughput(Mbps)" << endl;
+  for (uint32_t i = 0; i < config.senders; ++i)
+    {
+      throughput[i] = (flowBytes[i] * 8.0 / 1000000) / config.duration;
+      total += throughput[i];
+      flowFile << i << " " << senderDelay[i] << " " << throughput[i] << "\n";
+    }
+  flowFile.close ();
+
+  vector<double> sorted (throughput);
+  sort (sorted.begin (), sorted.end ());
+  uint32_t starved = 0;
+  for (size_t i = 0; i < sorted.size () && sorted[i] == 0; ++i)
+    {
+      starved++;
+    }
+  cout << " Dumbbell: " << config.senders << " flows to " << config.receivers << " receivers over "
+       << config.bottleneckRate << ", access delays " << config.delayMin << "-" << config.delayMax << " ms" << endl;
+  cout << " Aggregate throughput: " << total << " Mbps" << endl;
+  cout << " Per flow throughput: min " << sorted.front () << ", median " << sorted[sorted.size () / 2]
+       << ", max " << sorted.back () << " Mbps; " << starved << " flows got nothing" << endl;
+  cout << " Jain fairness index: " << JainIndex (throughput) << endl;
+  cout << " Per flow results are in dumbbell-flows.dat" << endl;
+  return 0;
 }
 
 int 
@@ -158,6 +359,22 @@ main (int argc, char *argv[])
 {
   // Setting the default tcpType to NewReno
   string tcpType = "NewReno";
+  string decimate = "all";
+  uint32_t decimateN = 10;
+  double decimateInterval = 0.01;
+  uint32_t verbosity = LAB_QUIET;
+  uint32_t queueSize = 10;
+  DumbbellConfig dumbbell;
+  dumbbell.senders = 0;
+  dumbbell.receivers = 1;
+  dumbbell.accessRate = "1.5Mbps";
+  dumbbell.bottleneckRate = "10Mbps";
+  dumbbell.bottleneckDelay = "10ms";
+  dumbbell.sourceRate = "1.5Mbps";
+  dumbbell.delayMin = 10;
+  dumbbell.delayMax = 10;
+  dumbbell.delayDist = "even";
+  dumbbell.duration = totalTime;
   
   
   uint16_t port = 9000;
@@ -165,12 +382,37 @@ main (int argc, char *argv[])
   // Parsing the command line arguments
   CommandLine cmd;
   cmd.AddValue ("Tcp", "Tcp type: 'NewReno', 'Tahoe', 'Reno', or 'Rfc793'", tcpType);
+  cmd.AddValue ("decimate", "Plot point decimation: 'all', 'nth', 'interval' or 'change'", decimate);
+  cmd.AddValue ("decimateN", "With --decimate=nth, keep every N-th point", decimateN);
+  cmd.AddValue ("decimateInterval", "With --decimate=interval, seconds between kept points", decimateInterval);
+  cmd.AddValue ("verbosity", "0 quiet, 1 progress, 2 every packet (skews timing)", verbosity);
+  cmd.AddValue ("queueSize", "DropTailQueue::MaxPackets of every link", queueSize);
+  cmd.AddValue ("senders", "Run a dumbbell with this many senders instead of n2 and n3", dumbbell.senders);
+  cmd.AddValue ("receivers", "Receivers of the dumbbell; flow i goes to receiver i % receivers", dumbbell.receivers);
+  cmd.AddValue ("accessRate", "Dumbbell access link rate", dumbbell.accessRate);
+  cmd.AddValue ("bottleneckRate", "Dumbbell bottleneck rate", dumbbell.bottleneckRate);
+  cmd.AddValue ("bottleneckDelay", "Dumbbell bottleneck delay", dumbbell.bottleneckDelay);
+  cmd.AddValue ("sourceRate", "OnOff rate of every dumbbell sender", dumbbell.sourceRate);
+  cmd.AddValue ("delayMin", "Smallest sender access delay in ms", dumbbell.delayMin);
+  cmd.AddValue ("delayMax", "Largest sender access delay in ms", dumbbell.delayMax);
+  cmd.AddValue ("delayDist", "Sender access delays: 'even' (evenly spread) or 'uniform' (random)", dumbbell.delayDist);
+  cmd.AddValue ("duration", "Dumbbell run time in seconds", dumbbell.duration);
   cmd.Parse (argc, argv);
+
+  EnableLabLogging (verbosity, "Lab4", 0);
   
   if(tcpType != "NewReno" && tcpType != "Tahoe" && tcpType != "Reno" && tcpType != "Rfc793"){
     NS_LOG_UNCOND ("The Tcp type must be either 'NewReno', 'Tahoe', 'Reno', or 'Rfc793'.");
     return 1;
   }
+
+  TraceDecimator::Mode decimateMode;
+  if(!TraceDecimator::ParseMode (decimate, decimateMode)){
+    NS_LOG_UNCOND ("The decimation mode must be 'all', 'nth', 'interval' or 'change'.");
+    return 1;
+  }
+  plot1Decimator.Configure (decimateMode, decimateN, decimateInterval);
+  plot2Decimator.Configure (decimateMode, decimateN, decimateInterval);
   
   // disable fragmentation
   Config::SetDefault ("ns3::WifiRemoteStationManager::FragmentationThreshold", StringValue ("2200"));
@@ -178,8 +420,18 @@ main (int argc, char *argv[])
   // Set tcp type
   Config::SetDefault ("ns3::TcpL4Protocol::SocketType", TypeIdValue(TypeId::LookupByName ("ns3::Tcp" + tcpType)));
   // Set maximum queue size
-  Config::SetDefault ("ns3::DropTailQueue::MaxPackets", UintegerValue(uint32_t(10)));
-  //LogComponentEnable("Lab3", LOG_LEVEL_INFO);
+  Config::SetDefault ("ns3::DropTailQueue::MaxPackets", UintegerValue(queueSize));
+
+  if (dumbbell.senders > 0)
+    {
+      if (dumbbell.receivers == 0 || dumbbell.delayMin > dumbbell.delayMax
+          || (dumbbell.delayDist != "even" && dumbbell.delayDist != "uniform"))
+        {
+          NS_LOG_UNCOND ("The dumbbell needs a receiver, delayMin <= delayMax and delayDist 'even' or 'uniform'.");
+          return 1;
+        }
+      return RunDumbbell (dumbbell);
+    }
 
   NS_LOG_INFO ("Creating Topology");
 
@@ -273,6 +525,12 @@ main (int argc, char *argv[])
   cout << " Throughput from Node 2: " << (node2BytesRcv * 8 / 1000000) / totalTime << " Mbps" << endl;
   cout << " Throughput from Node 3: " << (node3BytesRcv * 8 / 1000000) / totalTime << " Mbps" << endl;
   
+  if (decimateMode != TraceDecimator::ALL)
+    {
+      cout << " Plot points kept: " << plot1Decimator.GetPassed () << " of " << plot1Decimator.GetSeen ()
+           << " (Link1), " << plot2Decimator.GetPassed () << " of " << plot2Decimator.GetSeen () << " (Link2)" << endl;
+    }
+
   // Plotting the datasets in 'plot1.plt' and 'plot2.plt'
   plot1.plot();
   plot2.plot();
@@ -27,6 +27,28 @@
 // Queue Size is 10 for all the queues
 // Delay for n2n0 and n0n1 link is 10 ms throughput
 // Delay for n3n0 link is 10 ms initially and increased upto 100ms in units of 10ms
+//
+// Besides the delay, the sweep can vary the n0n1 rate, the queue size and the
+// TCP variant. Every axis takes a comma separated list or a 'start:stop:step'
+// range, either on the command line or in a grid file with one
+// "<axis> <values>" line per axis:
+//
+//   ./waf --run "fourth2 --delays=10:100:10 --rates=5Mbps,10Mbps --queues=10,50
+//                --Tcp=NewReno,Reno --jobs=0 --results=sweep.dat"
+//
+// Points are run in parallel worker processes (--jobs, 0 = all cores). With
+// --results every finished point is appended to that file as it completes,
+// and points already present there are not simulated again, so an
+// interrupted sweep picks up where it stopped. --cache=<dir> keeps every
+// result in a directory keyed by a hash of all inputs of the point (including
+// RngRun and the ns-3 release), so re-running a sweep after changing one axis
+// only simulates the points that are really new.
+//
+// With --converge a point does not run for the full totalTime: the ratio of
+// the two sink throughputs is sampled every --interval seconds and the run is
+// stopped once it stayed within --tolerance for --window seconds (but never
+// before --minTime, and at the latest at --maxTime). Each result record
+// states whether the point converged or hit the time limit.
 
 
 // The goal of this experiment is to find the relationship between
@@ -37,6 +59,16 @@
 #include <string>
 #include <cassert>
 #include <cstdio>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <map>
+#include <set>
+#include <deque>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <sys/stat.h>
 #include "ns3/core-module.h"
 #include "ns3/network-module.h"
 #include "ns3/csma-module.h"
@@ -51,6 +83,9 @@
 #include "ns3/point-to-point-remote-channel.h"
 #include "ns3/csma-net-device.h"
 #include "ns3/gnuplot.h"
+#include "../common/worker-pool.h"
+#include "../common/lab-log.h"
+#include "../common/counting-scheduler.h"
 
 using namespace std;
 using namespace ns3;
@@ -58,6 +93,16 @@ using namespace ns3;
 NS_LOG_COMPONENT_DEFINE ("Lab4");
 
 static const double totalTime = 5.0;
+// Fixed parts of the scenario; they are also part of the result cache key
+static const char *accessRate = "1.5Mbps";
+static const char *sourceRate = "1.5Mbps";
+static const char *linkDelay = "10ms";
+static const uint32_t packetSize = 2000;
+// Release the program is built against; part of the result cache key.
+// Pass -DLAB_NS3_VERSION=... when building against another release.
+#ifndef LAB_NS3_VERSION
+#define LAB_NS3_VERSION "ns-3.19"
+#endif
 static double node2BytesRcv;
 static double node3BytesRcv;
 
@@ -70,6 +115,8 @@ private:
   string m_dataTitle;
   Gnuplot m_plot;
   Gnuplot2dDataset m_dataset;
+  Gnuplot2dDataset m_modelDataset; // --surrogate predictions, never simulated
+  uint32_t m_modelPoints;
   
 public:
     Plotter(string fileNameWithNoExtension, string plotTitle, string dataTitle)
@@ -102,17 +149,35 @@ public:
       dataset.SetStyle (Gnuplot2dDataset::LINES_POINTS);
       
       m_dataset = dataset;
+
+      // Predicted points are drawn apart, so that they do not pass for measured
+      Gnuplot2dDataset modelDataset;
+      modelDataset.SetTitle (m_dataTitle + " (model)");
+      modelDataset.SetStyle (Gnuplot2dDataset::POINTS);
+
+      m_modelDataset = modelDataset;
+      m_modelPoints = 0;
     }
     
     void addDataset(double x, double y)
     {
       m_dataset.Add (x, y);
     }
+
+    void addModelPoint(double x, double y)
+    {
+      m_modelDataset.Add (x, y);
+      m_modelPoints++;
+    }
     
     void plot()
     {
       // Add the dataset to the plot.
       m_plot.AddDataset (m_dataset);
+      if (m_modelPoints > 0)
+        {
+          m_plot.AddDataset (m_modelDataset);
+        }
 
       // Open the plot file.
       ofstream plotFile (m_plotFileName.c_str());
@@ -134,7 +199,7 @@ Plotter plot4("plot4", "Final throughput vs Delay of link2", "Link2");
 void
 ReceiveNode2Packet (string context, Ptr<const Packet> p, const Address& addr)
 {
-  NS_LOG_INFO (context <<
+  LAB_PACKET_LOG (context <<
                  " Packet Received from Node 2 at " << Simulator::Now ().GetSeconds() << "from " << InetSocketAddress::ConvertFrom(addr).GetIpv4 ());
   node2BytesRcv += p->GetSize ();
 }
@@ -144,148 +209,1307 @@ ReceiveNode2Packet (string context, Ptr<const Packet> p, const Address& addr)
 void
 ReceiveNode3Packet (string context, Ptr<const Packet> p, const Address& addr)
 {
-  NS_LOG_INFO (context <<
+  LAB_PACKET_LOG (context <<
                  " Packet Received from Node 3 at " << Simulator::Now ().GetSeconds() << "from " << InetSocketAddress::ConvertFrom(addr).GetIpv4 ());
   
   node3BytesRcv += p->GetSize ();
 }
 
+// Shortest decimal form that reads back as the same double: "0.1" stays
+// "0.1", but two delays that only differ in the 7th digit keep differing
+static string
+FormatExact (double value)
+{
+  for (int precision = 6; ; ++precision)
+    {
+      ostringstream os;
+      os << setprecision (precision) << value;
+      if (precision >= 17 || atof (os.str ().c_str ()) == value)
+        {
+          return os.str ();
+        }
+    }
+}
+
+// One point of the sweep grid
+struct SweepPoint
+{
+  double delay;         // delay of the n3n0 link in ms
+  string rate;          // data rate of the n0n1 link
+  uint32_t queueSize;   // DropTailQueue::MaxPackets
+  string tcpType;       // 'NewReno', 'Tahoe', 'Reno' or 'Rfc793'
+
+  // The first four fields of a result record; identifies the point on resume
+  string Key () const
+  {
+    ostringstream os;
+    os << FormatExact (delay) << " " << rate << " " << queueSize << " " << tcpType;
+    return os.str ();
+  }
+};
+
+// Final throughput of both flows in Mbps, and how the run ended: 'fixed'
+// (ran for totalTime), 'converged' or 'timelimit' (with --converge)
+struct SweepResult
+{
+  double node2Throughput;
+  double node3Throughput;
+  string status;
+  double duration;
+};
+
+// How every point of the sweep is run
+struct RunOptions
+{
+  bool asciiTrace;
+  bool converge;        // stop as soon as the throughput ratio is stable
+  double tolerance;     // allowed relative spread of the ratio in the window
+  double window;        // seconds the ratio has to stay within tolerance
+  double interval;      // seconds between two ratio samples
+  double minTime;       // never stop before this time
+  double maxTime;       // give up and stop at this time
+  string scheduler;     // scheduler type; does not change the results
+};
+
+// Events and wall clock seconds of the last Simulator::Run (), for --scheduler
+static uint64_t pointEvents;
+static double pointWallSeconds;
+
+// Ratio samples (time, node2 bytes / node3 bytes) of the last window
+static deque<pair<double, double> > ratioSamples;
+static bool converged;
+
+// The values of every axis; the sweep is their cross product
+struct SweepGrid
+{
+  string delays;
+  string rates;
+  string queues;
+  string tcpTypes;
+};
+
+// Splits "a,b,c" into its non-empty items
+static vector<string>
+SplitList (const string &list, char separator)
+{
+  vector<string> items;
+  stringstream ss (list);
+  string item;
+  while (getline (ss, item, separator))
+    {
+      if (!item.empty ())
+        {
+          items.push_back (item);
+        }
+    }
+  return items;
+}
+
+// Expands a list of numbers where each item is either a value or a
+// 'start:stop:step' range, e.g. "10:100:10" or "5,10,20:40:10"
+static vector<double>
+ParseNumbers (const string &spec)
+{
+  vector<double> values;
+  vector<string> items = SplitList (spec, ',');
+  for (size_t i = 0; i < items.size (); ++i)
+    {
+      vector<string> range = SplitList (items[i], ':');
+      if (range.size () == 3)
+        {
+          double start = atof (range[0].c_str ());
+          double stop = atof (range[1].c_str ());
+          double step = atof (range[2].c_str ());
+          if (step <= 0)
+            {
+              NS_FATAL_ERROR ("Range '" << items[i] << "' needs a positive step");
+            }
+          if (stop < start)
+            {
+              NS_FATAL_ERROR ("Range '" << items[i] << "' ends before it starts");
+            }
+          // Index based so that a fractional step does not accumulate error
+          uint32_t count = static_cast<uint32_t> ((stop - start) / step + 1e-9) + 1;
+          for (uint32_t k = 0; k < count; ++k)
+            {
+              values.push_back (start + k * step);
+            }
+        }
+      else
+        {
+          values.push_back (atof (items[i].c_str ()));
+        }
+    }
+  return values;
+}
+
+// Reads "<axis> <values>" lines from a grid file; '#' starts a comment.
+// Axes that are not mentioned keep their command line value.
+static void
+ReadGridFile (const string &fileName, SweepGrid &grid)
+{
+  ifstream in (fileName.c_str ());
+  if (!in)
+    {
+      NS_FATAL_ERROR ("Cannot open grid file " << fileName);
+    }
+  string line;
+  while (getline (in, line))
+    {
+      line = line.substr (0, line.find ('#'));
+      istringstream ls (line);
+      string axis, values;
+      if (!(ls >> axis >> values))
+        {
+          continue;
+        }
+      if (axis == "delay" || axis == "delays")
+        {
+          grid.delays = values;
+        }
+      else if (axis == "rate" || axis == "rates")
+        {
+          grid.rates = values;
+        }
+      else if (axis == "queue" || axis == "queues")
+        {
+          grid.queues = values;
+        }
+      else if (axis == "tcp" || axis == "Tcp")
+        {
+          grid.tcpTypes = values;
+        }
+      else
+        {
+          NS_FATAL_ERROR ("Unknown axis '" << axis << "' in " << fileName);
+        }
+    }
+}
+
+// Formats a result record:
+// "<delay> <rate> <queue> <tcp> <thr n2> <thr n3> <status> <duration>"
+static string
+FormatRecord (const SweepPoint &point, const SweepResult &result)
+{
+  ostringstream os;
+  os << point.Key () << " " << result.node2Throughput << " " << result.node3Throughput
+     << " " << result.status << " " << result.duration << "\n";
+  return os.str ();
+}
+
+// Parses a record written by FormatRecord; returns false for anything else
+static bool
+ParseRecord (const string &record, SweepPoint &point, SweepResult &result)
+{
+  istringstream is (record);
+  if (!(is >> point.delay >> point.rate >> point.queueSize >> point.tcpType
+           >> result.node2Throughput >> result.node3Throughput))
+    {
+      return false;
+    }
+  // Records written before the convergence mode existed end here
+  if (!(is >> result.status >> result.duration))
+    {
+      result.status = "fixed";
+      result.duration = totalTime;
+    }
+  return true;
+}
+
+// Everything that determines the outcome of a point, as one canonical line
+static string
+CacheKey (const SweepPoint &point, const RunOptions &options)
+{
+  ostringstream os;
+  os << LAB_NS3_VERSION
+     << " seed=" << RngSeedManager::GetSeed ()
+     << " run=" << RngSeedManager::GetRun ();
+  if (options.converge)
+    {
+      os << " converge=" << options.tolerance << "/" << options.window << "/" << options.interval
+         << " time=" << options.minTime << "-" << options.maxTime;
+    }
+  else
+    {
+      os << " time=" << totalTime;
+    }
+  os
+     << " access=" << accessRate << "/" << linkDelay
+     << " source=" << sourceRate << "/" << packetSize
+     << " bottleneck=" << point.rate << "/" << linkDelay
+     << " delay=" << FormatExact (point.delay)
+     << " queue=" << point.queueSize
+     << " tcp=" << point.tcpType;
+  return os.str ();
+}
+
+// 64 bit FNV-1a; only used to name cache files
+static uint64_t
+HashKey (const string &key)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < key.size (); ++i)
+    {
+      hash ^= static_cast<unsigned char> (key[i]);
+      hash *= 1099511628211ULL;
+    }
+  return hash;
+}
+
+/**
+ * On-disk cache of finished points. Each entry is a file named after the hash
+ * of CacheKey () holding the full key (to rule out hash collisions) followed
+ * by the result record, so any change to an input simply misses.
+ */
+class SweepCache
+{
+public:
+  SweepCache (const string &dir, const RunOptions &options)
+    : m_dir (dir),
+      m_options (options)
+  {
+    if (mkdir (m_dir.c_str (), 0755) != 0 && errno != EEXIST)
+      {
+        NS_FATAL_ERROR ("Cannot create cache directory " << m_dir);
+      }
+  }
+
+  bool Lookup (const SweepPoint &point, string &record) const
+  {
+    string key = CacheKey (point, m_options);
+    ifstream in (Path (key).c_str ());
+    string storedKey;
+    if (!in || !getline (in, storedKey) || storedKey != key || !getline (in, record))
+      {
+        return false;
+      }
+    record += "\n";
+    return true;
+  }
+
+  void Store (const SweepPoint &point, const string &record) const
+  {
+    // Write then rename, so that an interrupted sweep never leaves half an entry
+    string key = CacheKey (point, m_options);
+    string path = Path (key);
+    string tmp = path + ".tmp";
+    ofstream out (tmp.c_str ());
+    out << key << "\n" << record;
+    out.close ();
+    if (!out || rename (tmp.c_str (), path.c_str ()) != 0)
+      {
+        NS_LOG_UNCOND ("Cannot write cache entry " << path);
+        remove (tmp.c_str ());
+      }
+  }
+
+private:
+  string Path (const string &key) const
+  {
+    char name[32];
+    snprintf (name, sizeof (name), "%016llx.rec", static_cast<unsigned long long> (HashKey (key)));
+    return m_dir + "/" + name;
+  }
+
+  string m_dir;
+  const RunOptions &m_options;
+};
+
+// Samples the ratio of the bytes received from n2 and n3 and stops the
+// simulation once it has stayed within the tolerance for a whole window
+static void
+CheckConvergence (const RunOptions *options)
+{
+  double now = Simulator::Now ().GetSeconds ();
+  if (node3BytesRcv > 0)
+    {
+      ratioSamples.push_back (make_pair (now, node2BytesRcv / node3BytesRcv));
+    }
+  while (!ratioSamples.empty () && ratioSamples.front ().first < now - options->window)
+    {
+      ratioSamples.pop_front ();
+    }
+
+  // Only decide once the samples span the whole window
+  if (now >= options->minTime && !ratioSamples.empty ()
+      && ratioSamples.front ().first <= now - options->window + options->interval / 2)
+    {
+      double low = ratioSamples.front ().second;
+      double high = low;
+      double sum = 0;
+      for (size_t i = 0; i < ratioSamples.size (); ++i)
+        {
+          low = min (low, ratioSamples[i].second);
+          high = max (high, ratioSamples[i].second);
+          sum += ratioSamples[i].second;
+        }
+      double mean = sum / ratioSamples.size ();
+      if (high - low <= options->tolerance * mean)
+        {
+          converged = true;
+          Simulator::Stop ();
+          return;
+        }
+    }
+
+  if (now + options->interval < options->maxTime)
+    {
+      Simulator::Schedule (Seconds (options->interval), &CheckConvergence, options);
+    }
+}
+
+// Clears what the previous point left in the globals. Anything else the
+// simulation keeps (nodes, channels, the address generator) goes with
+// Simulator::Destroy (), so points can follow each other in one process.
+static void
+ResetPointState ()
+{
+  node2BytesRcv = 0.0;
+  node3BytesRcv = 0.0;
+  ratioSamples.clear ();
+  converged = false;
+}
+
+// Builds the topology for one sweep point, runs it for totalTime (or until
+// the throughput ratio converges) and returns the throughput of both flows
+static SweepResult
+RunPoint (const SweepPoint &point, const RunOptions &options)
+{
+  double runTime = options.converge ? options.maxTime : totalTime;
+
+  uint16_t port = 9000;
+
+  // Before anything is scheduled
+  UseCountingScheduler (options.scheduler);
+
+  // Set tcp type
+  Config::SetDefault ("ns3::TcpL4Protocol::SocketType", TypeIdValue(TypeId::LookupByName ("ns3::Tcp" + point.tcpType)));
+  // Set maximum queue size
+  Config::SetDefault ("ns3::DropTailQueue::MaxPackets", UintegerValue(point.queueSize));
+
+  NS_LOG_INFO ("Creating Topology");
+
+  ResetPointState ();
+
+  // Create 4 nodes
+  NodeContainer nodes;
+  nodes.Create (4);
+
+  // Create appropriate node containers
+  NodeContainer n0n1 (nodes.Get (0), nodes.Get (1));
+  NodeContainer n2n0 (nodes.Get (2), nodes.Get (0));
+  NodeContainer n3n0 (nodes.Get (3), nodes.Get (0));
+
+  // Assigning datarate of 10Mbps and delay of 10ms to d2d0
+  PointToPointHelper link;
+  link.SetDeviceAttribute("DataRate", DataRateValue(DataRate(accessRate)));
+  link.SetChannelAttribute("Delay", TimeValue(Time(linkDelay)));
+
+  NetDeviceContainer d2d0 = link.Install(n2n0);
+
+  // Changing delay to 'delay' ms for d3d0 link. Rounded to whole nanoseconds
+  // so that fractional delays from a range do not pick up float noise.
+  link.SetChannelAttribute("Delay", TimeValue(NanoSeconds(static_cast<int64_t> (point.delay * 1000000 + 0.5))));
+  NetDeviceContainer d3d0 = link.Install(n3n0);
+
+  // Changing the datarate to 'rate' and delay to 10ms for d0d1 link
+  link.SetDeviceAttribute("DataRate", DataRateValue(DataRate(point.rate)));
+  link.SetChannelAttribute("Delay", TimeValue(Time(linkDelay)));
+  NetDeviceContainer d0d1 = link.Install (n0n1);
+
+  // Installing stack on all the nodes
+  InternetStackHelper stack;
+  stack.Install (nodes);
+
+  // Assigning addresses to all the interfaces
+  Ipv4AddressHelper address;
+
+  // n0 ---------------------------------------- n1
+  // 10.1.1.1                              10.1.1.2   
+  address.SetBase ("10.1.1.0", "255.255.255.0");
+  Ipv4InterfaceContainer i0i1 = address.Assign (d0d1);
+
+  // n2 ---------------------------------------- n0
+  // 10.1.2.1                              10.1.2.2   
+  address.SetBase ("10.1.2.0", "255.255.255.0");
+  Ipv4InterfaceContainer i2i0 = address.Assign (d2d0);
+
+  // n3 ---------------------------------------- n0
+  // 10.1.3.1                              10.1.3.2   
+  address.SetBase ("10.1.3.0", "255.255.255.0");
+  Ipv4InterfaceContainer i3i0 = address.Assign (d3d0);
+
+  ApplicationContainer apps;
+
+  // Setting up source with OnOffHelper at n2 and n3
+  OnOffHelper source("ns3::TcpSocketFactory", InetSocketAddress(i0i1.GetAddress (1), port));
+  source.SetAttribute ("OnTime", StringValue ("ns3::ConstantRandomVariable[Constant=5]"));
+  source.SetAttribute ("OffTime", StringValue ("ns3::ConstantRandomVariable[Constant=0]"));
+  source.SetAttribute ("DataRate", DataRateValue (DataRate (sourceRate)));
+  source.SetAttribute ("PacketSize", UintegerValue (packetSize));
+
+  // n2 tries to connect to n1 on port 9000
+  apps.Add (source.Install (nodes.Get (2)));
+
+  // n3 tries to connect to n2 on port 9001
+  source.SetAttribute ("Remote", AddressValue(InetSocketAddress(i0i1.GetAddress (1), port + 1)));
+  apps.Add (source.Install (nodes.Get (3)));
+
+  // Setting up sink with packet sink helper
+  // The sinks are at 10.1.1.2:9000 and 10.1.1.2:9001
+  PacketSinkHelper sink ("ns3::TcpSocketFactory", InetSocketAddress(i0i1.GetAddress (1), port));
+  apps.Add(sink.Install (nodes.Get (1)));
+
+  sink.SetAttribute("Local", AddressValue(InetSocketAddress(i0i1.GetAddress(1), port + 1)));
+  apps.Add (sink.Install (nodes.Get (1)));
+
+  // Starting the applications to run for totalTime
+  apps.Start(Seconds (0));
+  apps.Stop(Seconds (runTime));
+
+  NS_LOG_INFO ("Enable static global routing.");
+  Ipv4GlobalRoutingHelper::PopulateRoutingTables ();
+
+  string context = "/NodeList/1/ApplicationList/0/$ns3::PacketSink/Rx";
+  Config::Connect (context, MakeCallback(&ReceiveNode2Packet));
+
+  context = "/NodeList/1/ApplicationList/1/$ns3::PacketSink/Rx";
+  Config::Connect (context, MakeCallback(&ReceiveNode3Packet));
+
+  if (options.asciiTrace)
+    {
+      AsciiTraceHelper ascii;
+      link.EnableAsciiAll (ascii.CreateFileStream ("lab3-rtt.tr"));
+    }
+
+  if (options.converge)
+    {
+      Simulator::Schedule (Seconds (options.interval), &CheckConvergence, &options);
+    }
+
+  Simulator::Stop(Seconds(runTime));
+  SystemWallClockMs wallClock;
+  wallClock.Start ();
+  Simulator::Run ();
+  pointWallSeconds = wallClock.End () / 1000.0;
+  pointEvents = CountingScheduler::GetExecuted ();
+  // The time the run really ended; earlier than runTime if it converged
+  double duration = converged ? Simulator::Now ().GetSeconds () : runTime;
+  Simulator::Destroy ();
+
+  SweepResult result;
+  result.node2Throughput = (node2BytesRcv * 8 / 1000000) / duration;
+  result.node3Throughput = (node3BytesRcv * 8 / 1000000) / duration;
+  result.status = !options.converge ? "fixed" : converged ? "converged" : "timelimit";
+  result.duration = duration;
+  return result;
+}
+
+// Runs every point of the sweep once per scheduler, one after the other in
+// this process so that the timings are comparable, and prints the events per
+// second of each. The results have to be the same for every scheduler.
+static void
+CompareSchedulers (const vector<SweepPoint> &points, const vector<string> &schedulers, RunOptions options)
+{
+  vector<SweepResult> reference;
+  cout << left << setw (10) << "Scheduler" << right << setw (8) << "Points" << setw (14) << "Events"
+       << setw (12) << "Wall (s)" << setw (14) << "Events/s" << "  Results" << endl;
+  for (size_t s = 0; s < schedulers.size (); ++s)
+    {
+      SchedulerTypeName (schedulers[s], options.scheduler);
+      uint64_t events = 0;
+      double wallSeconds = 0;
+      bool same = true;
+      for (size_t i = 0; i < points.size (); ++i)
+        {
+          SweepResult result = RunPoint (points[i], options);
+          events += pointEvents;
+          wallSeconds += pointWallSeconds;
+          if (s == 0)
+            {
+              reference.push_back (result);
+            }
+          else if (result.node2Throughput != reference[i].node2Throughput
+                   || result.node3Throughput != reference[i].node3Throughput)
+            {
+              same = false;
+            }
+        }
+      cout << left << setw (10) << schedulers[s] << right << setw (8) << points.size () << setw (14) << events
+           << setw (12) << wallSeconds << setw (14) << static_cast<uint64_t> (wallSeconds > 0 ? events / wallSeconds : 0)
+           << "  " << (s == 0 ? "reference" : same ? "same" : "DIFFERENT") << endl;
+    }
+}
+
+// Runs the grid points through the worker pool. Finished points are printed,
+// kept for plotting and appended to the result file as soon as they arrive.
+class SweepTask : public WorkerTask
+{
+public:
+  SweepTask (const vector<SweepPoint> &points, ofstream *resultFile, SweepCache *cache,
+             bool verbosePoint, const RunOptions &options)
+    : m_points (points),
+      m_resultFile (resultFile),
+      m_cache (cache),
+      m_verbosePoint (verbosePoint),
+      m_options (options)
+  {
+  }
+
+  virtual string Run (uint32_t index)
+  {
+    return FormatRecord (m_points[index], RunPoint (m_points[index], m_options));
+  }
+
+  virtual void Collect (uint32_t index, const string &record)
+  {
+    if (Report (index, record) && m_cache)
+      {
+        m_cache->Store (m_points[index], record);
+      }
+  }
+
+  // Prints and records a finished point, simulated or taken from the cache
+  bool Report (uint32_t index, const string &record)
+  {
+    SweepPoint point;
+    SweepResult result;
+    if (!ParseRecord (record, point, result))
+      {
+        cerr << "Ignoring malformed result for point " << m_points[index].Key () << endl;
+        return false;
+      }
+    m_results[point.Key ()] = result;
+
+    cout << endl << "Delay for link 2: " << point.delay << "ms" << endl;
+    if (m_verbosePoint)
+      {
+        cout << " Rate of link 0-1: " << point.rate << ", queue size: " << point.queueSize
+             << ", Tcp: " << point.tcpType << endl;
+      }
+    cout << " Throughput from Node 2: " << result.node2Throughput << " Mbps" << endl;
+    cout << " Throughput from Node 3: " << result.node3Throughput << " Mbps" << endl;
+    if (result.status != "fixed")
+      {
+        cout << " Stopped at " << result.duration << "s ("
+             << (result.status == "converged" ? "converged" : "time limit") << ")" << endl;
+      }
+
+    if (m_resultFile)
+      {
+        *m_resultFile << record << flush;
+      }
+    return true;
+  }
+
+  // Results loaded from an earlier, interrupted run
+  void Preload (const SweepPoint &point, const SweepResult &result)
+  {
+    m_results[point.Key ()] = result;
+  }
+
+  bool Has (const SweepPoint &point) const
+  {
+    return m_results.find (point.Key ()) != m_results.end ();
+  }
+
+  const SweepResult &Get (const SweepPoint &point) const
+  {
+    return m_results.find (point.Key ())->second;
+  }
+
+private:
+  const vector<SweepPoint> &m_points;
+  ofstream *m_resultFile;
+  SweepCache *m_cache;
+  bool m_verbosePoint;
+  const RunOptions &m_options;
+  map<string, SweepResult> m_results;
+};
+
+/**
+ * Analytical surrogate of a sweep point, for --surrogate. Both flows share
+ * the n0n1 bottleneck and so see about the same loss rate p; with Mathis'
+ * formula, throughput = MSS / (RTT * sqrt (p)) * C, their split then only
+ * depends on the ratio of their round trip times:
+ *
+ *   x2 / x3 = (RTT3 / RTT2) ^ alpha
+ *
+ * alpha (1 in Mathis' formula) and the efficiency (the share of the
+ * capacity both flows together get) are fitted to the points simulated so
+ * far. Each flow is also limited by its source rate.
+ */
+struct SurrogateModel
+{
+  double alpha;
+  double efficiency;
+  double sigma;         // residual spread of log (x2 / x3) in the fit
+  uint32_t samples;
+};
+
+// Round trip time of a flow in ms, without queueing: its access link and the bottleneck
+static double
+BaseRtt (double accessDelay)
+{
+  return 2 * (accessDelay + Time (linkDelay).GetSeconds () * 1000);
+}
+
+// RTT3 / RTT2: n2's access link has the fixed delay, n3's the point's
+static double
+RttRatio (const SweepPoint &point)
+{
+  return BaseRtt (point.delay) / BaseRtt (Time (linkDelay).GetSeconds () * 1000);
+}
+
+// Mbps both flows together can get at most
+static double
+Capacity (const SweepPoint &point)
+{
+  return min (DataRate (point.rate).GetBitRate (), 2 * DataRate (sourceRate).GetBitRate ()) / 1e6;
+}
+
+static SweepResult
+Predict (const SurrogateModel &model, const SweepPoint &point, double alpha)
+{
+  double capacity = model.efficiency * Capacity (point);
+  double limit = DataRate (sourceRate).GetBitRate () / 1e6;
+  double ratio = pow (RttRatio (point), alpha);
+  SweepResult result;
+  result.node2Throughput = min (capacity * ratio / (1 + ratio), limit);
+  result.node3Throughput = min (capacity - result.node2Throughput, limit);
+  result.node2Throughput = min (capacity - result.node3Throughput, limit);
+  result.status = "model";
+  result.duration = 0;
+  return result;
+}
+
+// Least squares fit of alpha and the efficiency to the simulated points
+static SurrogateModel
+FitSurrogate (const vector<SweepPoint> &points, const SweepTask &task)
+{
+  SurrogateModel model;
+  double zz = 0, zy = 0, used = 0, offered = 0;
+  vector<pair<double, double> > samples;
+  for (size_t i = 0; i < points.size (); ++i)
+    {
+      if (!task.Has (points[i]) || task.Get (points[i]).status == "model")
+        {
+          continue;
+        }
+      const SweepResult &result = task.Get (points[i]);
+      used += result.node2Throughput + result.node3Throughput;
+      offered += Capacity (points[i]);
+      // Only points where both flows got something tell the split
+      if (result.node2Throughput > 0 && result.node3Throughput > 0)
+        {
+          double z = log (RttRatio (points[i]));
+          double y = log (result.node2Throughput / result.node3Throughput);
+          zz += z * z;
+          zy += z * y;
+          samples.push_back (make_pair (z, y));
+        }
+    }
+  model.alpha = zz > 0 ? zy / zz : 1.0;
+  model.efficiency = offered > 0 ? used / offered : 1.0;
+  model.samples = samples.size ();
+  double squares = 0;
+  for (size_t i = 0; i < samples.size (); ++i)
+    {
+      double residual = samples[i].second - model.alpha * samples[i].first;
+      squares += residual * residual;
+    }
+  model.sigma = samples.size () > 1 ? sqrt (squares / (samples.size () - 1)) : 1.0;
+  return model;
+}
+
+// Simulated neighbours of points[index] along the delay axis of its line
+// (the same rate, queue size and Tcp type); -1 where there is none
+static void
+FindNeighbours (const vector<SweepPoint> &points, const SweepTask &task, size_t index, size_t lineLength,
+                int &below, int &above)
+{
+  size_t first = index / lineLength * lineLength;
+  below = -1;
+  above = -1;
+  for (size_t i = first; i < first + lineLength && i < points.size (); ++i)
+    {
+      if (i == index || !task.Has (points[i]) || task.Get (points[i]).status == "model")
+        {
+          continue;
+        }
+      if (points[i].delay < points[index].delay && (below < 0 || points[i].delay > points[below].delay))
+        {
+          below = i;
+        }
+      if (points[i].delay > points[index].delay && (above < 0 || points[i].delay < points[above].delay))
+        {
+          above = i;
+        }
+    }
+}
+
+/**
+ * Sweep driver of --surrogate. Every stride-th point of each delay line (and
+ * the last one) is simulated first. Then, in rounds, the model is refitted
+ * and a pending point is simulated if the model is uncertain there (its
+ * residual spread moves the prediction by more than 'tolerance' of the
+ * capacity) or disagrees by as much with the interpolation of the simulated
+ * neighbours; the points left are taken from the model. Prints the error of
+ * the final model against every simulated point.
+ */
+static void
+RunWithSurrogate (SweepTask &task, const vector<SweepPoint> &points, const vector<uint32_t> &pending,
+                  size_t lineLength, uint32_t jobs, uint32_t stride, double tolerance)
+{
+  vector<uint32_t> calibration;
+  vector<uint32_t> remaining;
+  for (size_t i = 0; i < pending.size (); ++i)
+    {
+      uint32_t position = pending[i] % lineLength;
+      if (position % stride == 0 || position == lineLength - 1)
+        {
+          calibration.push_back (pending[i]);
+        }
+      else
+        {
+          remaining.push_back (pending[i]);
+        }
+    }
+  RunWorkers (task, calibration, jobs);
+  uint32_t simulated = calibration.size ();
+
+  SurrogateModel model = FitSurrogate (points, task);
+  while (!remaining.empty ())
+    {
+      vector<uint32_t> uncertain;
+      vector<uint32_t> settled;
+      for (size_t i = 0; i < remaining.size (); ++i)
+        {
+          const SweepPoint &point = points[remaining[i]];
+          double allowed = tolerance * Capacity (point);
+          SweepResult predicted = Predict (model, point, model.alpha);
+          double z = log (RttRatio (point));
+          // alpha moved so that the ratio changes by one residual spread
+          double spreadAlpha = z != 0 ? model.alpha + model.sigma / fabs (z) : model.alpha;
+          bool doubtful = model.samples < 2
+            || fabs (Predict (model, point, spreadAlpha).node2Throughput - predicted.node2Throughput) > allowed;
+
+          int below, above;
+          FindNeighbours (points, task, remaining[i], lineLength, below, above);
+          if (!doubtful && below >= 0 && above >= 0)
+            {
+              const SweepResult &low = task.Get (points[below]);
+              const SweepResult &high = task.Get (points[above]);
+              double w = (point.delay - points[below].delay) / (points[above].delay - points[below].delay);
+              double n2 = low.node2Throughput + w * (high.node2Throughput - low.node2Throughput);
+              double n3 = low.node3Throughput + w * (high.node3Throughput - low.node3Throughput);
+              doubtful = fabs (n2 - predicted.node2Throughput) > allowed
+                || fabs (n3 - predicted.node3Throughput) > allowed;
+            }
+          if (doubtful)
+            {
+              uncertain.push_back (remaining[i]);
+            }
+          else
+            {
+              settled.push_back (remaining[i]);
+            }
+        }
+      if (uncertain.empty ())
+        {
+          break;
+        }
+      NS_LOG_INFO ("Surrogate: simulating " << uncertain.size () << " uncertain points");
+      RunWorkers (task, uncertain, jobs);
+      simulated += uncertain.size ();
+      model = FitSurrogate (points, task);
+      remaining = settled;
+    }
+
+  for (size_t i = 0; i < remaining.size (); ++i)
+    {
+      const SweepPoint &point = points[remaining[i]];
+      SweepResult predicted = Predict (model, point, model.alpha);
+      task.Preload (point, predicted);
+      cout << endl << "Delay for link 2: " << point.delay << "ms (model)" << endl;
+      cout << " Throughput from Node 2: " << predicted.node2Throughput << " Mbps" << endl;
+      cout << " Throughput from Node 3: " << predicted.node3Throughput << " Mbps" << endl;
+    }
+
+  // How far the final model is from what was simulated
+  double errorSum = 0, errorMax = 0;
+  uint32_t compared = 0;
+  for (size_t i = 0; i < points.size (); ++i)
+    {
+      if (!task.Has (points[i]) || task.Get (points[i]).status == "model")
+        {
+          continue;
+        }
+      SweepResult predicted = Predict (model, points[i], model.alpha);
+      double error = max (fabs (predicted.node2Throughput - task.Get (points[i]).node2Throughput),
+                          fabs (predicted.node3Throughput - task.Get (points[i]).node3Throughput));
+      errorSum += error;
+      errorMax = max (errorMax, error);
+      compared++;
+    }
+  cout << endl << "Surrogate: simulated " << simulated << " and predicted " << remaining.size () << " of "
+       << pending.size () << " points; alpha " << model.alpha << ", efficiency " << model.efficiency << endl;
+  if (compared > 0)
+    {
+      cout << " Model error against " << compared << " simulated points: mean " << errorSum / compared
+           << " Mbps, max " << errorMax << " Mbps" << endl;
+    }
+}
+
+// An interval of a delay line whose ends differ by 'change' Mbps
+struct RefineCandidate
+{
+  double change;
+  size_t line;
+  double delay;         // the middle of the interval
+};
+
+static bool
+LargerChange (const RefineCandidate &a, const RefineCandidate &b)
+{
+  return a.change > b.change;
+}
+
+/**
+ * Adaptive refinement of the delay axis, for --refine. Once the grid is
+ * done, every interval between two neighbouring simulated delays of a line
+ * whose throughputs differ by more than 'threshold' Mbps (for either flow)
+ * is halved, the largest changes first, and the new points are simulated
+ * like the grid ones; a point of the --surrogate model in the middle is
+ * simulated instead. This repeats until no interval changes that much, the
+ * intervals are 'minInterval' ms wide or 'budget' points were simulated;
+ * points already in the result file of an earlier run are free. The delays
+ * added are appended to 'delays' so that they are plotted.
+ */
+static void
+RefineDelays (SweepTask &task, vector<SweepPoint> &points, size_t lineLength, uint32_t jobs,
+              double threshold, double minInterval, uint32_t budget, vector<double> &delays)
+{
+  size_t lines = points.size () / lineLength;
+  vector<set<double> > lineDelays (lines);
+  for (size_t i = 0; i < lines * lineLength; ++i)
+    {
+      lineDelays[i / lineLength].insert (points[i].delay);
+    }
+
+  uint32_t added = 0;
+  uint32_t simulated = 0;
+  while (simulated < budget)
+    {
+      vector<RefineCandidate> candidates;
+      for (size_t l = 0; l < lines; ++l)
+        {
+          SweepPoint point = points[l * lineLength];
+          bool havePrevious = false;
+          double previousDelay = 0;
+          SweepResult previous;
+          for (set<double>::const_iterator d = lineDelays[l].begin (); d != lineDelays[l].end (); ++d)
+            {
+              point.delay = *d;
+              // Only simulated points: refining the surrogate's curve would
+              // only find where the model bends
+              if (!task.Has (point) || task.Get (point).status == "model")
+                {
+                  continue;
+                }
+              const SweepResult &current = task.Get (point);
+              if (havePrevious && *d - previousDelay > minInterval)
+                {
+                  double change = max (fabs (current.node2Throughput - previous.node2Throughput),
+                                       fabs (current.node3Throughput - previous.node3Throughput));
+                  if (change > threshold)
+                    {
+                      RefineCandidate candidate = { change, l, (previousDelay + *d) / 2 };
+                      candidates.push_back (candidate);
+                    }
+                }
+              havePrevious = true;
+              previousDelay = *d;
+              previous = current;
+            }
+        }
+      if (candidates.empty ())
+        {
+          break;
+        }
+      sort (candidates.begin (), candidates.end (), &LargerChange);
+
+      vector<uint32_t> indices;
+      uint32_t addedBefore = added;
+      for (size_t c = 0; c < candidates.size () && simulated + indices.size () < budget; ++c)
+        {
+          SweepPoint point = points[candidates[c].line * lineLength];
+          point.delay = candidates[c].delay;
+          if (lineDelays[candidates[c].line].insert (point.delay).second)
+            {
+              points.push_back (point);
+              delays.push_back (point.delay);
+              added++;
+              // Already known from the result file of an earlier run
+              if (!task.Has (point))
+                {
+                  indices.push_back (points.size () - 1);
+                }
+              continue;
+            }
+          // The middle is a grid point with only a model value: simulate it
+          for (size_t i = 0; i < points.size (); ++i)
+            {
+              if (points[i].Key () == point.Key ())
+                {
+                  if (task.Has (points[i]) && task.Get (points[i]).status == "model")
+                    {
+                      indices.push_back (i);
+                    }
+                  break;
+                }
+            }
+        }
+      if (indices.empty () && added == addedBefore)
+        {
+          break;        // nothing new would come out of another pass
+        }
+      NS_LOG_INFO ("Refinement: simulating " << indices.size () << " more points");
+      RunWorkers (task, indices, jobs);
+      simulated += indices.size ();
+    }
+  cout << endl << "Refinement: added " << added << " delays (" << simulated << " simulated)";
+  if (simulated == budget)
+    {
+      cout << ", point budget used up";
+    }
+  cout << endl;
+}
+
+static bool
+IsTcpTypeValid (const string &tcpType)
+{
+  return tcpType == "NewReno" || tcpType == "Tahoe" || tcpType == "Reno" || tcpType == "Rfc793";
+}
+
+// DataRate (string) aborts on a malformed rate; the attribute parser does not
+static bool
+IsRateValid (const string &rate)
+{
+  DataRateValue value;
+  return value.DeserializeFromString (rate, MakeDataRateChecker ());
+}
+
+/**
+ * Persistent worker, for --serve: reads "<delay> <rate> <queue> <tcp>" lines
+ * (as in the result records) from stdin until it is closed and answers each
+ * with its result record on stdout, or with "error <line>". The process
+ * start-up and the type registration are paid once; every point builds its
+ * own topology and ends with Simulator::Destroy (). Nothing is plotted,
+ * cached or traced.
+ */
+static int
+ServePoints (const RunOptions &options)
+{
+  string line;
+  while (getline (cin, line))
+    {
+      if (line.find_first_not_of (" \t\r") == string::npos)
+        {
+          continue;
+        }
+      istringstream is (line);
+      SweepPoint point;
+      if (!(is >> point.delay >> point.rate >> point.queueSize >> point.tcpType)
+          || point.delay < 0 || !IsRateValid (point.rate)
+          || point.queueSize == 0 || !IsTcpTypeValid (point.tcpType))
+        {
+          cout << "error " << line << endl;
+          continue;
+        }
+      cout << FormatRecord (point, RunPoint (point, options)) << flush;
+    }
+  return 0;
+}
+
 int 
 main (int argc, char *argv[])
 {
   // Setting the default tcpType to NewReno
   string tcpType = "NewReno";
-  
-  
-  uint16_t port = 9000;
+  SweepGrid grid;
+  grid.delays = "10:100:10";
+  grid.rates = "10Mbps";
+  grid.queues = "10";
+  string gridFile = "";
+  string resultFileName = "";
+  string cacheDir = "";
+  uint32_t jobs = 1;
+  uint32_t verbosity = LAB_QUIET;
+  RunOptions options;
+  options.asciiTrace = true;
+  options.converge = false;
+  options.tolerance = 0.02;
+  options.window = 1.0;
+  options.interval = 0.05;
+  options.minTime = 1.0;
+  options.maxTime = totalTime;
+  string scheduler = "map";
+  bool surrogate = false;
+  uint32_t surrogateStride = 4;
+  double surrogateTolerance = 0.05;
+  double refine = 0;
+  uint32_t refineBudget = 20;
+  double refineMin = 1.0;
+  bool serve = false;
   
   // Parsing the command line arguments
   CommandLine cmd;
-  cmd.AddValue ("Tcp", "Tcp type: 'NewReno', 'Tahoe', 'Reno', or 'Rfc793'", tcpType);
+  cmd.AddValue ("Tcp", "Tcp types, comma separated: 'NewReno', 'Tahoe', 'Reno', or 'Rfc793'", tcpType);
+  cmd.AddValue ("delays", "Delays of link n3n0 in ms: list and/or start:stop:step ranges", grid.delays);
+  cmd.AddValue ("rates", "Data rates of link n0n1, comma separated", grid.rates);
+  cmd.AddValue ("queues", "DropTailQueue::MaxPackets values: list and/or ranges", grid.queues);
+  cmd.AddValue ("grid", "File with '<axis> <values>' lines (delays, rates, queues, tcp)", gridFile);
+  cmd.AddValue ("results", "Result file; finished points are appended and skipped on the next run", resultFileName);
+  cmd.AddValue ("cache", "Directory of cached point results; only cache misses are simulated", cacheDir);
+  cmd.AddValue ("jobs", "Number of parallel worker processes (0 = one per core)", jobs);
+  cmd.AddValue ("asciiTrace", "Write lab3-rtt.tr (single worker only)", options.asciiTrace);
+  cmd.AddValue ("converge", "Stop each point once the n2/n3 throughput ratio is stable", options.converge);
+  cmd.AddValue ("tolerance", "Allowed relative spread of the throughput ratio", options.tolerance);
+  cmd.AddValue ("window", "Seconds the ratio has to stay within the tolerance", options.window);
+  cmd.AddValue ("interval", "Seconds between two throughput ratio samples", options.interval);
+  cmd.AddValue ("minTime", "Earliest time a converging point may stop", options.minTime);
+  cmd.AddValue ("maxTime", "Time limit of a converging point", options.maxTime);
+  cmd.AddValue ("scheduler", "Event scheduler: 'map', 'heap', 'list', 'calendar' or 'dary'; a comma separated list or 'all' compares them", scheduler);
+  cmd.AddValue ("surrogate", "Simulate only the points an analytical throughput model cannot predict", surrogate);
+  cmd.AddValue ("surrogateStride", "With --surrogate, every N-th delay of a line is simulated to calibrate the model", surrogateStride);
+  cmd.AddValue ("surrogateTolerance", "With --surrogate, allowed model error as a share of the capacity", surrogateTolerance);
+  cmd.AddValue ("refine", "Halve delay intervals whose throughput changes by more than this many Mbps (0 = off)", refine);
+  cmd.AddValue ("refineBudget", "With --refine, most points simulated in all", refineBudget);
+  cmd.AddValue ("refineMin", "With --refine, narrowest delay interval in ms", refineMin);
+  cmd.AddValue ("serve", "Persistent worker: run the '<delay> <rate> <queue> <tcp>' points read from stdin, one result record per line", serve);
+  cmd.AddValue ("verbosity", "0 quiet, 1 progress, 2 every packet (skews timing)", verbosity);
   cmd.Parse (argc, argv);
+
+  EnableLabLogging (verbosity, "Lab4", 0);
+
+  grid.tcpTypes = tcpType;
+  if (!gridFile.empty ())
+    {
+      ReadGridFile (gridFile, grid);
+    }
+
+  vector<double> delays = ParseNumbers (grid.delays);
+  vector<string> rates = SplitList (grid.rates, ',');
+  vector<double> queues = ParseNumbers (grid.queues);
+  vector<string> tcpTypes = SplitList (grid.tcpTypes, ',');
+  if (delays.empty () || rates.empty () || queues.empty () || tcpTypes.empty ())
+    {
+      NS_LOG_UNCOND ("Every axis of the sweep needs at least one value.");
+      return 1;
+    }
+
+  for (size_t i = 0; i < queues.size (); ++i)
+    {
+      if (queues[i] < 1 || queues[i] != floor (queues[i]))
+        {
+          NS_LOG_UNCOND ("Queue sizes must be whole numbers of packets, not " << queues[i] << ".");
+          return 1;
+        }
+    }
+
+  for (size_t i = 0; i < tcpTypes.size (); ++i)
+    {
+      if(!IsTcpTypeValid (tcpTypes[i])){
+        NS_LOG_UNCOND ("The Tcp type must be either 'NewReno', 'Tahoe', 'Reno', or 'Rfc793'.");
+        return 1;
+      }
+    }
   
-  if(tcpType != "NewReno" && tcpType != "Tahoe" && tcpType != "Reno" && tcpType != "Rfc793"){
-    NS_LOG_UNCOND ("The Tcp type must be either 'NewReno', 'Tahoe', 'Reno', or 'Rfc793'.");
-    return 1;
-  }
-  
+  vector<string> schedulers = SplitList (scheduler, ',');
+  if (scheduler == "all")
+    {
+      schedulers.clear ();
+      for (uint32_t i = 0; SCHEDULER_NAMES[i]; ++i)
+        {
+          string typeName;
+          if (SchedulerTypeName (SCHEDULER_NAMES[i], typeName))
+            {
+              schedulers.push_back (SCHEDULER_NAMES[i]);
+            }
+        }
+    }
+  for (size_t i = 0; i < schedulers.size (); ++i)
+    {
+      if (!SchedulerTypeName (schedulers[i], options.scheduler))
+        {
+          NS_LOG_UNCOND ("The scheduler must be 'map', 'heap', 'list', 'calendar' or 'dary'.");
+          return 1;
+        }
+    }
+  if (schedulers.empty ())
+    {
+      NS_LOG_UNCOND ("The scheduler must be 'map', 'heap', 'list', 'calendar' or 'dary'.");
+      return 1;
+    }
+  SchedulerTypeName (schedulers[0], options.scheduler);
+
   // disable fragmentation
   Config::SetDefault ("ns3::WifiRemoteStationManager::FragmentationThreshold", StringValue ("2200"));
   Config::SetDefault ("ns3::WifiRemoteStationManager::RtsCtsThreshold", StringValue ("2200"));
-  // Set tcp type
-  Config::SetDefault ("ns3::TcpL4Protocol::SocketType", TypeIdValue(TypeId::LookupByName ("ns3::Tcp" + tcpType)));
-  // Set maximum queue size
-  Config::SetDefault ("ns3::DropTailQueue::MaxPackets", UintegerValue(uint32_t(10)));
-  //LogComponentEnable("Lab3", LOG_LEVEL_INFO);
 
-  NS_LOG_INFO ("Creating Topology");
+  // The cross product of all axes, delay varying fastest
+  vector<SweepPoint> points;
+  for (size_t t = 0; t < tcpTypes.size (); ++t)
+    {
+      for (size_t q = 0; q < queues.size (); ++q)
+        {
+          for (size_t r = 0; r < rates.size (); ++r)
+            {
+              for (size_t d = 0; d < delays.size (); ++d)
+                {
+                  SweepPoint point;
+                  point.delay = delays[d];
+                  point.rate = rates[r];
+                  point.queueSize = static_cast<uint32_t> (queues[q]);
+                  point.tcpType = tcpTypes[t];
+                  points.push_back (point);
+                }
+            }
+        }
+    }
 
-  for(int delay = 10; delay <= 100; delay += 10)
-  {
-      node2BytesRcv = 0.0;
-      node3BytesRcv = 0.0;
-      
-      // Create 4 nodes
-      NodeContainer nodes;
-      nodes.Create (4);
-      
-      // Create appropriate node containers
-      NodeContainer n0n1 (nodes.Get (0), nodes.Get (1));
-      NodeContainer n2n0 (nodes.Get (2), nodes.Get (0));
-      NodeContainer n3n0 (nodes.Get (3), nodes.Get (0));
-
-      // Assigning datarate of 10Mbps and delay of 10ms to d2d0
-      PointToPointHelper link;
-      link.SetDeviceAttribute("DataRate", DataRateValue(DataRate("1.5Mbps")));
-      link.SetChannelAttribute("Delay", TimeValue(Time("10ms")));
-      
-      NetDeviceContainer d2d0 = link.Install(n2n0);
-      
-      // Changing delay to 'delay' ms for d3d0 link
-      link.SetChannelAttribute("Delay", TimeValue(MilliSeconds(delay)));
-      NetDeviceContainer d3d0 = link.Install(n3n0);
-      
-      // Changing the datarate to 10Mbps and delay to 10ms for d0d1 link
-      link.SetDeviceAttribute("DataRate", DataRateValue(DataRate("10Mbps")));
-      link.SetChannelAttribute("Delay", TimeValue(Time("10ms")));
-      NetDeviceContainer d0d1 = link.Install (n0n1);
-      
-      // Installing stack on all the nodes
-      InternetStackHelper stack;
-      stack.Install (nodes);
+  // Parallel workers would all write the same trace file
+  if (jobs != 1 && options.asciiTrace)
+    {
+      NS_LOG_UNCOND ("lab3-rtt.tr is only written with --jobs=1; disabling it.");
+      options.asciiTrace = false;
+    }
+  if (options.converge && (options.interval <= 0 || options.window <= 0 || options.minTime > options.maxTime))
+    {
+      NS_LOG_UNCOND ("Convergence needs a positive interval and window, and minTime <= maxTime.");
+      return 1;
+    }
 
-      // Assigning addresses to all the interfaces
-      Ipv4AddressHelper address;
-      
-      // n0 ---------------------------------------- n1
-      // 10.1.1.1                              10.1.1.2   
-      address.SetBase ("10.1.1.0", "255.255.255.0");
-      Ipv4InterfaceContainer i0i1 = address.Assign (d0d1);
-
-      // n2 ---------------------------------------- n0
-      // 10.1.2.1                              10.1.2.2   
-      address.SetBase ("10.1.2.0", "255.255.255.0");
-      Ipv4InterfaceContainer i2i0 = address.Assign (d2d0);
-
-      // n3 ---------------------------------------- n0
-      // 10.1.3.1                              10.1.3.2   
-      address.SetBase ("10.1.3.0", "255.255.255.0");
-      Ipv4InterfaceContainer i3i0 = address.Assign (d3d0);
-      
-      ApplicationContainer apps;
-      
-      // Setting up source with OnOffHelper at n2 and n3
-      OnOffHelper source("ns3::TcpSocketFactory", InetSocketAddress(i0i1.GetAddress (1), port));
-      source.SetAttribute ("OnTime", StringValue ("ns3::ConstantRandomVariable[Constant=5]"));
-      source.SetAttribute ("OffTime", StringValue ("ns3::ConstantRandomVariable[Constant=0]"));
-      source.SetAttribute ("DataRate", DataRateValue (DataRate ("1.5Mbps")));
-      source.SetAttribute ("PacketSize", UintegerValue (2000));
-      
-      // n2 tries to connect to n1 on port 9000
-      apps.Add (source.Install (nodes.Get (2)));
-      
-      // n3 tries to connect to n2 on port 9001
-      source.SetAttribute ("Remote", AddressValue(InetSocketAddress(i0i1.GetAddress (1), port + 1)));
-      apps.Add (source.Install (nodes.Get (3)));
-      
-      // Setting up sink with packet sink helper
-      // The sinks are at 10.1.1.2:9000 and 10.1.1.2:9001
-      PacketSinkHelper sink ("ns3::TcpSocketFactory", InetSocketAddress(i0i1.GetAddress (1), port));
-      apps.Add(sink.Install (nodes.Get (1)));
-      
-      sink.SetAttribute("Local", AddressValue(InetSocketAddress(i0i1.GetAddress(1), port + 1)));
-      apps.Add (sink.Install (nodes.Get (1)));
-      
-      // Starting the applications to run for totalTime
-      apps.Start(Seconds (0));
-      apps.Stop(Seconds (totalTime));
+  // Persistent worker: the points come from stdin instead of the grid
+  if (serve)
+    {
+      options.asciiTrace = false;
+      return ServePoints (options);
+    }
 
-      NS_LOG_INFO ("Enable static global routing.");
-      Ipv4GlobalRoutingHelper::PopulateRoutingTables ();
-      
-      string context = "/NodeList/1/ApplicationList/0/$ns3::PacketSink/Rx";
-      Config::Connect (context, MakeCallback(&ReceiveNode2Packet));
-      
-      context = "/NodeList/1/ApplicationList/1/$ns3::PacketSink/Rx";
-      Config::Connect (context, MakeCallback(&ReceiveNode3Packet));
-      
-      AsciiTraceHelper ascii;
-      link.EnableAsciiAll (ascii.CreateFileStream ("lab3-rtt.tr"));
+  // Several schedulers: time the whole sweep under each, nothing else
+  if (schedulers.size () > 1)
+    {
+      options.asciiTrace = false;
+      CompareSchedulers (points, schedulers, options);
+      return 0;
+    }
 
-      Simulator::Stop(Seconds(totalTime));
-      Simulator::Run ();
-      Simulator::Destroy ();
-      
-      cout << endl << "Delay for link 2: " << delay << "ms" << endl;
-      cout << " Throughput from Node 2: " << (node2BytesRcv * 8 / 1000000) / totalTime << " Mbps" << endl;
-      cout << " Throughput from Node 3: " << (node3BytesRcv * 8 / 1000000) / totalTime << " Mbps" << endl;
-      
-      plot3.addDataset(delay, (node2BytesRcv * 8 / 1000000) / totalTime);
-      plot4.addDataset(delay, (node3BytesRcv * 8 / 1000000) / totalTime);
-  } 
+  bool verbosePoint = rates.size () > 1 || queues.size () > 1 || tcpTypes.size () > 1;
+  ofstream resultFile;
+  SweepCache *cache = cacheDir.empty () ? 0 : new SweepCache (cacheDir, options);
+  SweepTask task (points, resultFileName.empty () ? 0 : &resultFile, cache, verbosePoint, options);
+
+  if (!resultFileName.empty ())
+    {
+      // Resume: everything already in the result file counts as done
+      ifstream previous (resultFileName.c_str ());
+      string line;
+      uint32_t loaded = 0;
+      while (getline (previous, line))
+        {
+          SweepPoint point;
+          SweepResult result;
+          if (ParseRecord (line, point, result))
+            {
+              task.Preload (point, result);
+              ++loaded;
+            }
+        }
+      previous.close ();
+      if (loaded > 0)
+        {
+          cout << "Loaded " << loaded << " finished points from " << resultFileName << endl;
+        }
+      resultFile.open (resultFileName.c_str (), ios::app);
+      if (!resultFile)
+        {
+          NS_LOG_UNCOND ("Cannot open the result file " << resultFileName);
+          return 1;
+        }
+    }
+
+  vector<uint32_t> pending;
+  uint32_t cacheHits = 0;
+  for (uint32_t i = 0; i < points.size (); ++i)
+    {
+      if (task.Has (points[i]))
+        {
+          continue;
+        }
+      string record;
+      if (cache && cache->Lookup (points[i], record) && task.Report (i, record))
+        {
+          ++cacheHits;
+          continue;
+        }
+      pending.push_back (i);
+    }
+  if (pending.size () != points.size ())
+    {
+      cout << pending.size () << " of " << points.size () << " points left to simulate";
+      if (cache)
+        {
+          cout << " (" << cacheHits << " taken from " << cacheDir << ")";
+        }
+      cout << endl;
+    }
+
+  if (surrogate)
+    {
+      RunWithSurrogate (task, points, pending, delays.size (), jobs, max (surrogateStride, 1u), surrogateTolerance);
+    }
+  else
+    {
+      RunWorkers (task, pending, jobs);
+    }
+  if (refine > 0)
+    {
+      RefineDelays (task, points, delays.size (), jobs, refine, refineMin, refineBudget, delays);
+    }
+
+  // Plot throughput against delay for the first rate, queue size and tcp type
+  // of the grid, so that the default sweep gives the usual plot3 and plot4
+  sort (delays.begin (), delays.end ());
+  delays.erase (unique (delays.begin (), delays.end ()), delays.end ());
+  for (size_t d = 0; d < delays.size (); ++d)
+    {
+      SweepPoint point;
+      point.delay = delays[d];
+      point.rate = rates[0];
+      point.queueSize = static_cast<uint32_t> (queues[0]);
+      point.tcpType = tcpTypes[0];
+      if (task.Has (point) && task.Get (point).status == "model")
+        {
+          plot3.addModelPoint(point.delay, task.Get (point).node2Throughput);
+          plot4.addModelPoint(point.delay, task.Get (point).node3Throughput);
+        }
+      else if (task.Has (point))
+        {
+          plot3.addDataset(point.delay, task.Get (point).node2Throughput);
+          plot4.addDataset(point.delay, task.Get (point).node3Throughput);
+        }
+    }
   // Plotting the datasets in 'plot3.plt' and 'plot4.plt'
   plot3.plot();
   plot4.plot();
+
+  if (resultFile.is_open ())
+    {
+      resultFile.close ();
+    }
+  delete cache;
   
   return 0;
 }
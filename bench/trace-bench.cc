@@ -0,0 +1,247 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+// Microbenchmarks of the trace callbacks of third.cc and fourth1.cc.
+//
+// The programs are compiled into this one, each inside a namespace of its
+// own and with its main() renamed, so the callbacks benchmarked are exactly
+// the ones the programs run. Every callback is called with synthetic
+// events from inside a running simulator (at t = 1s) and the time and the
+// number of operator new calls per call are reported:
+//
+//   ./waf --run "trace-bench --iterations=1000000 --filter=third"
+//
+// Copy this directory into scratch/ next to the numbered directories.
+
+// Everything the programs include comes first, so that the includes inside
+// the namespaces below are no-ops.
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <time.h>
+#include "ns3/core-module.h"
+#include "ns3/network-module.h"
+#include "ns3/csma-module.h"
+#include "ns3/internet-module.h"
+#include "ns3/point-to-point-module.h"
+#include "ns3/applications-module.h"
+#include "ns3/ipv4-global-routing-helper.h"
+#include "ns3/service-flow.h"
+#include "ns3/flow-monitor-module.h"
+#include "ns3/tcp-l4-protocol.h"
+#include "ns3/point-to-point-net-device.h"
+#include "ns3/point-to-point-remote-channel.h"
+#include "ns3/csma-net-device.h"
+#include "ns3/gnuplot.h"
+#include "../common/trace-decimator.h"
+#include "../common/trace-writer.h"
+#include "../common/lab-log.h"
+#include "../common/latency-histogram.h"
+#include "../common/worker-pool.h"
+#include "../common/counting-scheduler.h"
+#include "../common/hash-flow-monitor.h"
+
+namespace third {
+#define main third_main
+#include "../3/third.cc"
+#undef main
+}
+
+namespace fourth1 {
+#define main fourth1_main
+#include "../4/fourth1.cc"
+#undef main
+}
+
+using namespace ns3;
+using namespace std;
+
+// Every operator new in the process is counted, ns-3's and the trace writer
+// thread's included
+static uint64_t allocations = 0;
+
+#if __cplusplus >= 201103L
+#define BENCH_THROW_BAD_ALLOC
+#else
+#define BENCH_THROW_BAD_ALLOC throw (std::bad_alloc)
+#endif
+
+void *
+operator new (size_t size) BENCH_THROW_BAD_ALLOC
+{
+  __atomic_fetch_add (&allocations, 1, __ATOMIC_RELAXED);
+  void *p = malloc (size > 0 ? size : 1);
+  if (p == 0)
+    {
+      throw std::bad_alloc ();
+    }
+  return p;
+}
+
+void *
+operator new[] (size_t size) BENCH_THROW_BAD_ALLOC
+{
+  return operator new (size);
+}
+
+void
+operator delete (void *p) throw ()
+{
+  free (p);
+}
+
+void
+operator delete[] (void *p) throw ()
+{
+  free (p);
+}
+
+static uint64_t iterations = 1000000;
+static string filter = "";
+
+// Shared synthetic events
+static Ptr<const Packet> packet;
+static Address from;
+static string queueContext = "/NodeList/0/DeviceList/0/$ns3::PointToPointNetDevice/TxQueue/Enqueue";
+static string sinkContext = "/NodeList/1/ApplicationList/0/$ns3::PacketSink/Rx";
+
+typedef void (*BenchBody) (uint64_t n);
+
+static double
+NowNs ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Runs 'body' for a warm-up round and then for the measured iterations
+static void
+Measure (const string &name, BenchBody body)
+{
+  if (name.find (filter) == string::npos)
+    {
+      return;
+    }
+  body (iterations / 100 + 1);
+  uint64_t allocationsBefore = allocations;
+  double start = NowNs ();
+  body (iterations);
+  double elapsed = NowNs () - start;
+  uint64_t allocated = allocations - allocationsBefore;
+  cout << left << setw (36) << name << right << fixed << setprecision (1)
+       << setw (10) << elapsed / iterations << " ns/call"
+       << setprecision (3) << setw (10) << static_cast<double> (allocated) / iterations << " allocs/call" << endl;
+  cout.unsetf (ios::floatfield);
+}
+
+static void
+BenchCwndTracer (uint64_t n)
+{
+  for (uint64_t i = 0; i < n; ++i)
+    {
+      third::CwndTracer1 (i, i + 536);
+    }
+}
+
+static void
+BenchEnqueueDequeue (uint64_t n)
+{
+  for (uint64_t i = 0; i < n; ++i)
+    {
+      third::Enqueue (queueContext, packet);
+      third::Dequeue (queueContext, packet);
+    }
+}
+
+static void
+BenchReceivePacket (uint64_t n)
+{
+  for (uint64_t i = 0; i < n; ++i)
+    {
+      third::ReceivePacket (sinkContext, packet, from);
+    }
+}
+
+static void
+BenchReceiveNode2Packet (uint64_t n)
+{
+  for (uint64_t i = 0; i < n; ++i)
+    {
+      fourth1::ReceiveNode2Packet (sinkContext, packet, from);
+    }
+}
+
+static void
+BenchAddDataset (uint64_t n)
+{
+  for (uint64_t i = 0; i < n; ++i)
+    {
+      fourth1::plot2.addDataset (i, 1.5);
+    }
+}
+
+static void
+RunBenchmarks ()
+{
+  packet = Create<Packet> (2000);
+  from = InetSocketAddress (Ipv4Address ("172.16.24.1"), 49153);
+
+  Measure ("third/CwndTracer1", &BenchCwndTracer);
+  Measure ("third/Enqueue+Dequeue", &BenchEnqueueDequeue);
+  Measure ("third/ReceivePacket", &BenchReceivePacket);
+  Measure ("fourth1/ReceiveNode2Packet", &BenchReceiveNode2Packet);
+  Measure ("fourth1/Plotter::addDataset", &BenchAddDataset);
+
+  packet = 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+  bool asyncTrace = true;
+
+  CommandLine cmd;
+  cmd.AddValue ("iterations", "Calls per benchmark", iterations);
+  cmd.AddValue ("filter", "Only run benchmarks whose name contains this", filter);
+  cmd.AddValue ("asyncTrace", "Hand third.cc trace records to the writer thread, as third.cc does by default", asyncTrace);
+  cmd.Parse (argc, argv);
+
+  // third.cc's trace streams all go to /dev/null
+  for (int i = 0; i < 5; ++i)
+    {
+      third::cwnd[i] = third::traceWriter.AddStream ("/dev/null", &third::FormatCwnd);
+      third::recvfile[i] = third::traceWriter.AddStream ("/dev/null", &third::FormatRecv);
+    }
+  third::queueFile = third::traceWriter.AddStream ("/dev/null", &third::FormatQueue);
+  third::traceWriter.Start (asyncTrace);
+
+  Simulator::Schedule (Seconds (1), &RunBenchmarks);
+  Simulator::Run ();
+  Simulator::Destroy ();
+  third::traceWriter.Stop ();
+  return 0;
+}
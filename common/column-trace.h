@@ -0,0 +1,322 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+// Binary columnar trace files (.col).
+//
+// Every row has the same four fixed-width columns:
+//
+//   time   double    simulation time in seconds, never decreasing
+//   value  double    cwnd, queue length, rate, loss ratio, ...
+//   flow   uint32    flow index, or COLUMN_NO_FLOW
+//   event  uint32    index into the event name table of the header
+//
+// Rows are grouped in blocks of COLUMN_BLOCK_ROWS; inside a block each column
+// is stored contiguously, so a reader that only needs times and flows never
+// touches the values. The file is a ColumnHeader followed by whole blocks and
+// is written and read through mmap. Because time never decreases, a time range
+// is found by binary search without reading the rest of the file.
+
+#ifndef LAB_COLUMN_TRACE_H
+#define LAB_COLUMN_TRACE_H
+
+#include <string>
+#include <cstring>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char COLUMN_MAGIC[8] = { 'L', 'A', 'B', 'C', 'O', 'L', '0', '1' };
+static const uint32_t COLUMN_BLOCK_ROWS = 4096;
+static const uint32_t COLUMN_MAX_EVENTS = 16;
+static const uint32_t COLUMN_EVENT_NAME = 16;
+static const uint32_t COLUMN_NO_FLOW = 0xffffffff;
+
+struct ColumnHeader
+{
+  char magic[8];
+  uint32_t blockRows;
+  uint32_t eventCount;
+  uint64_t rowCount;
+  char eventNames[COLUMN_MAX_EVENTS][COLUMN_EVENT_NAME];
+};
+
+/**
+ * Byte offsets of the columns of a block relative to the start of the block.
+ */
+static const uint64_t COLUMN_TIME_OFFSET = 0;
+static const uint64_t COLUMN_VALUE_OFFSET = 8 * COLUMN_BLOCK_ROWS;
+static const uint64_t COLUMN_FLOW_OFFSET = 16 * COLUMN_BLOCK_ROWS;
+static const uint64_t COLUMN_EVENT_OFFSET = 20 * COLUMN_BLOCK_ROWS;
+static const uint64_t COLUMN_BLOCK_SIZE = 24 * COLUMN_BLOCK_ROWS;
+
+/**
+ * Appends rows to a .col file. The file grows in chunks of blocks and is
+ * mapped into memory, so appending a row is a few stores.
+ */
+class ColumnTraceWriter
+{
+public:
+  ColumnTraceWriter ()
+    : m_fd (-1),
+      m_map (0),
+      m_mapped (0),
+      m_header (0)
+  {
+  }
+
+  ~ColumnTraceWriter ()
+  {
+    Close ();
+  }
+
+  bool Open (const std::string &fileName)
+  {
+    m_fd = open (fileName.c_str (), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (m_fd < 0 || !Grow (64))
+      {
+        return false;
+      }
+    memcpy (m_header->magic, COLUMN_MAGIC, sizeof (COLUMN_MAGIC));
+    m_header->blockRows = COLUMN_BLOCK_ROWS;
+    m_header->eventCount = 0;
+    m_header->rowCount = 0;
+    return true;
+  }
+
+  bool IsOpen () const
+  {
+    return m_header != 0;
+  }
+
+  /**
+   * Adds an event name to the header and returns its index.
+   */
+  uint32_t AddEvent (const std::string &name)
+  {
+    if (m_header == 0)
+      {
+        return 0;
+      }
+    uint32_t index = m_header->eventCount;
+    if (index < COLUMN_MAX_EVENTS)
+      {
+        strncpy (m_header->eventNames[index], name.c_str (), COLUMN_EVENT_NAME - 1);
+        m_header->eventCount++;
+      }
+    return index;
+  }
+
+  void Append (double time, double value, uint32_t flow, uint32_t event)
+  {
+    if (m_header == 0)
+      {
+        return;
+      }
+    uint64_t row = m_header->rowCount;
+    uint64_t block = row / COLUMN_BLOCK_ROWS;
+    if (sizeof (ColumnHeader) + (block + 1) * COLUMN_BLOCK_SIZE > m_mapped && !Grow (2 * (block + 1)))
+      {
+        return;
+      }
+    char *base = m_map + sizeof (ColumnHeader) + block * COLUMN_BLOCK_SIZE;
+    uint64_t i = row % COLUMN_BLOCK_ROWS;
+    reinterpret_cast<double *> (base + COLUMN_TIME_OFFSET)[i] = time;
+    reinterpret_cast<double *> (base + COLUMN_VALUE_OFFSET)[i] = value;
+    reinterpret_cast<uint32_t *> (base + COLUMN_FLOW_OFFSET)[i] = flow;
+    reinterpret_cast<uint32_t *> (base + COLUMN_EVENT_OFFSET)[i] = event;
+    m_header->rowCount = row + 1;
+  }
+
+  /**
+   * Trims the file to the blocks in use and unmaps it. Safe to call twice.
+   */
+  void Close ()
+  {
+    if (m_map)
+      {
+        uint64_t blocks = (m_header->rowCount + COLUMN_BLOCK_ROWS - 1) / COLUMN_BLOCK_ROWS;
+        munmap (m_map, m_mapped);
+        m_map = 0;
+        m_header = 0;
+        if (ftruncate (m_fd, sizeof (ColumnHeader) + blocks * COLUMN_BLOCK_SIZE) != 0)
+          {
+            // The rows are all there; the file just keeps its unused tail
+          }
+      }
+    if (m_fd >= 0)
+      {
+        close (m_fd);
+        m_fd = -1;
+      }
+  }
+
+private:
+  // The old mapping is only dropped once the new one exists, so a failure
+  // leaves the rows written so far mapped and the writer usable
+  bool Grow (uint64_t blocks)
+  {
+    uint64_t size = sizeof (ColumnHeader) + blocks * COLUMN_BLOCK_SIZE;
+    if (ftruncate (m_fd, size) != 0)
+      {
+        return false;
+      }
+    void *map = mmap (0, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (map == MAP_FAILED)
+      {
+        return false;
+      }
+    if (m_map)
+      {
+        munmap (m_map, m_mapped);
+      }
+    m_map = static_cast<char *> (map);
+    m_mapped = size;
+    m_header = reinterpret_cast<ColumnHeader *> (m_map);
+    return true;
+  }
+
+  int m_fd;
+  char *m_map;
+  uint64_t m_mapped;
+  ColumnHeader *m_header;
+};
+
+/**
+ * Read-only view of a .col file. Only the pages that are actually looked at
+ * are read from disk.
+ */
+class ColumnTraceReader
+{
+public:
+  ColumnTraceReader ()
+    : m_map (0),
+      m_size (0),
+      m_header (0)
+  {
+  }
+
+  ~ColumnTraceReader ()
+  {
+    if (m_map)
+      {
+        munmap (m_map, m_size);
+      }
+  }
+
+  bool Open (const std::string &fileName)
+  {
+    int fd = open (fileName.c_str (), O_RDONLY);
+    if (fd < 0)
+      {
+        return false;
+      }
+    struct stat st;
+    if (fstat (fd, &st) != 0 || static_cast<uint64_t> (st.st_size) < sizeof (ColumnHeader))
+      {
+        close (fd);
+        return false;
+      }
+    void *map = mmap (0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED)
+      {
+        return false;
+      }
+    m_map = static_cast<char *> (map);
+    m_size = st.st_size;
+    m_header = reinterpret_cast<const ColumnHeader *> (m_map);
+    uint64_t blocks = (m_header->rowCount + COLUMN_BLOCK_ROWS - 1) / COLUMN_BLOCK_ROWS;
+    return memcmp (m_header->magic, COLUMN_MAGIC, sizeof (COLUMN_MAGIC)) == 0
+      && m_header->blockRows == COLUMN_BLOCK_ROWS
+      && sizeof (ColumnHeader) + blocks * COLUMN_BLOCK_SIZE <= m_size;
+  }
+
+  uint64_t GetRowCount () const
+  {
+    return m_header->rowCount;
+  }
+
+  uint32_t GetEventCount () const
+  {
+    return m_header->eventCount < COLUMN_MAX_EVENTS ? m_header->eventCount : COLUMN_MAX_EVENTS;
+  }
+
+  std::string GetEventName (uint32_t event) const
+  {
+    if (event >= GetEventCount ())
+      {
+        return "?";
+      }
+    return std::string (m_header->eventNames[event],
+                        strnlen (m_header->eventNames[event], COLUMN_EVENT_NAME));
+  }
+
+  double Time (uint64_t row) const
+  {
+    return reinterpret_cast<const double *> (Block (row) + COLUMN_TIME_OFFSET)[row % COLUMN_BLOCK_ROWS];
+  }
+
+  double Value (uint64_t row) const
+  {
+    return reinterpret_cast<const double *> (Block (row) + COLUMN_VALUE_OFFSET)[row % COLUMN_BLOCK_ROWS];
+  }
+
+  uint32_t Flow (uint64_t row) const
+  {
+    return reinterpret_cast<const uint32_t *> (Block (row) + COLUMN_FLOW_OFFSET)[row % COLUMN_BLOCK_ROWS];
+  }
+
+  uint32_t Event (uint64_t row) const
+  {
+    return reinterpret_cast<const uint32_t *> (Block (row) + COLUMN_EVENT_OFFSET)[row % COLUMN_BLOCK_ROWS];
+  }
+
+  /**
+   * First row with a time of at least t (binary search).
+   */
+  uint64_t LowerBound (double t) const
+  {
+    uint64_t low = 0;
+    uint64_t high = GetRowCount ();
+    while (low < high)
+      {
+        uint64_t mid = low + (high - low) / 2;
+        if (Time (mid) < t)
+          {
+            low = mid + 1;
+          }
+        else
+          {
+            high = mid;
+          }
+      }
+    return low;
+  }
+
+private:
+  const char *Block (uint64_t row) const
+  {
+    return m_map + sizeof (ColumnHeader) + (row / COLUMN_BLOCK_ROWS) * COLUMN_BLOCK_SIZE;
+  }
+
+  char *m_map;
+  uint64_t m_size;
+  const ColumnHeader *m_header;
+};
+
+#endif /* LAB_COLUMN_TRACE_H */
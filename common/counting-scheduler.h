@@ -0,0 +1,195 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+// Event counting for the simulator.
+//
+// The simulator does not tell how many events it executed, so this scheduler
+// wraps the real one (ns3::MapScheduler by default, see the "Inner"
+// attribute) and counts every event it hands out. Install it before
+// anything is scheduled:
+//
+//   UseCountingScheduler ("ns3::MapScheduler");
+//   ...
+//   Simulator::Run ();
+//   uint64_t events = CountingScheduler::GetExecuted ();
+//
+// SetObserver() additionally hands every event to a function right before
+// the simulator runs it, e.g. to measure how late a real-time run is.
+//
+// SchedulerTypeName() maps the short names taken by the --scheduler options
+// to the scheduler types, including the 4-ary heap of dary-heap-scheduler.h.
+
+#ifndef LAB_COUNTING_SCHEDULER_H
+#define LAB_COUNTING_SCHEDULER_H
+
+#include <string>
+#include "ns3/core-module.h"
+#include "dary-heap-scheduler.h"
+
+namespace ns3 {
+
+class CountingScheduler : public Scheduler
+{
+public:
+  typedef void (*Observer) (const Scheduler::Event &ev);
+
+  static TypeId GetTypeId (void)
+  {
+    static TypeId tid = TypeId ("ns3::CountingScheduler")
+      .SetParent<Scheduler> ()
+      .AddConstructor<CountingScheduler> ()
+      .AddAttribute ("Inner", "The scheduler that really keeps the events",
+                     StringValue ("ns3::MapScheduler"),
+                     MakeStringAccessor (&CountingScheduler::m_innerType),
+                     MakeStringChecker ())
+    ;
+    return tid;
+  }
+
+  CountingScheduler ()
+  {
+    s_executed = 0;
+  }
+
+  virtual void Insert (const Event &ev)
+  {
+    Inner ()->Insert (ev);
+  }
+
+  virtual bool IsEmpty (void) const
+  {
+    return Inner ()->IsEmpty ();
+  }
+
+  virtual Event PeekNext (void) const
+  {
+    return Inner ()->PeekNext ();
+  }
+
+  virtual Event RemoveNext (void)
+  {
+    s_executed++;
+    if (s_observer == 0)
+      {
+        return Inner ()->RemoveNext ();
+      }
+    Event next = Inner ()->RemoveNext ();
+    s_observer (next);
+    return next;
+  }
+
+  virtual void Remove (const Event &ev)
+  {
+    Inner ()->Remove (ev);
+  }
+
+  /**
+   * Events handed to the simulator since the scheduler was created.
+   * There is only one simulator per process, so a single counter will do.
+   */
+  static uint64_t GetExecuted (void)
+  {
+    return s_executed;
+  }
+
+  /**
+   * Calls 'observer' with every event handed to the simulator; 0 stops it.
+   */
+  static void SetObserver (Observer observer)
+  {
+    s_observer = observer;
+  }
+
+private:
+  // Attributes are set after construction, so the inner scheduler is
+  // created on first use
+  Ptr<Scheduler> Inner (void) const
+  {
+    if (m_inner == 0)
+      {
+        ObjectFactory factory;
+        factory.SetTypeId (m_innerType);
+        m_inner = factory.Create<Scheduler> ();
+      }
+    return m_inner;
+  }
+
+  std::string m_innerType;
+  mutable Ptr<Scheduler> m_inner;
+  static uint64_t s_executed;
+  static Observer s_observer;
+};
+
+uint64_t CountingScheduler::s_executed = 0;
+CountingScheduler::Observer CountingScheduler::s_observer = 0;
+
+NS_OBJECT_ENSURE_REGISTERED (CountingScheduler);
+
+/**
+ * Makes the simulator count its events, keeping 'inner' as the real scheduler.
+ */
+inline void
+UseCountingScheduler (std::string inner)
+{
+  ObjectFactory factory;
+  factory.SetTypeId ("ns3::CountingScheduler");
+  factory.Set ("Inner", StringValue (inner));
+  Simulator::SetScheduler (factory);
+}
+
+/**
+ * Short names of the schedulers: 'map', 'heap', 'list', 'calendar' and
+ * 'dary'. Sets typeName and returns true if the scheduler exists here.
+ */
+inline bool
+SchedulerTypeName (const std::string &name, std::string &typeName)
+{
+  if (name == "map")
+    {
+      typeName = "ns3::MapScheduler";
+    }
+  else if (name == "heap")
+    {
+      typeName = "ns3::HeapScheduler";
+    }
+  else if (name == "list")
+    {
+      typeName = "ns3::ListScheduler";
+    }
+  else if (name == "calendar")
+    {
+      typeName = "ns3::CalendarScheduler";
+    }
+  else if (name == "dary")
+    {
+      typeName = "ns3::DaryHeapScheduler";
+    }
+  else
+    {
+      return false;
+    }
+  TypeId tid;
+  return TypeId::LookupByNameFailSafe (typeName, &tid);
+}
+
+/**
+ * All the short names, in the order a comparison runs them
+ */
+static const char *const SCHEDULER_NAMES[] = { "map", "heap", "list", "calendar", "dary", 0 };
+
+} // namespace ns3
+
+#endif /* LAB_COUNTING_SCHEDULER_H */
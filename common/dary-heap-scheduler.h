@@ -0,0 +1,165 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+// Event scheduler on a 4-ary implicit heap.
+//
+// ns3::HeapScheduler is a binary heap; ns3::MapScheduler a red-black tree
+// with one allocation per event. This one keeps the events in one vector,
+// four children per node: the heap is half as deep as a binary one and the
+// four children of a node are adjacent, so sifting down touches about half
+// as many cache lines. Events are ordered by (timestamp, uid) like in every
+// other ns-3 scheduler, so a run gives the same results with any of them.
+
+#ifndef LAB_DARY_HEAP_SCHEDULER_H
+#define LAB_DARY_HEAP_SCHEDULER_H
+
+#include <vector>
+#include "ns3/core-module.h"
+
+namespace ns3 {
+
+class DaryHeapScheduler : public Scheduler
+{
+public:
+  static TypeId GetTypeId (void)
+  {
+    static TypeId tid = TypeId ("ns3::DaryHeapScheduler")
+      .SetParent<Scheduler> ()
+      .AddConstructor<DaryHeapScheduler> ()
+    ;
+    return tid;
+  }
+
+  DaryHeapScheduler ()
+  {
+    // Spares the first doublings of a busy simulation
+    m_heap.reserve (1024);
+  }
+
+  virtual void Insert (const Event &ev)
+  {
+    m_heap.push_back (ev);
+    SiftUp (m_heap.size () - 1);
+  }
+
+  virtual bool IsEmpty (void) const
+  {
+    return m_heap.empty ();
+  }
+
+  virtual Event PeekNext (void) const
+  {
+    return m_heap.front ();
+  }
+
+  virtual Event RemoveNext (void)
+  {
+    Event next = m_heap.front ();
+    RemoveAt (0);
+    return next;
+  }
+
+  /**
+   * Only used by Simulator::Remove (not by Cancel), so a linear search like
+   * in ns3::HeapScheduler is good enough.
+   */
+  virtual void Remove (const Event &ev)
+  {
+    for (size_t i = 0; i < m_heap.size (); ++i)
+      {
+        if (m_heap[i].key.m_uid == ev.key.m_uid)
+          {
+            RemoveAt (i);
+            return;
+          }
+      }
+  }
+
+private:
+  static const size_t ARITY = 4;
+
+  static bool Less (const Event &a, const Event &b)
+  {
+    return a.key.m_ts < b.key.m_ts
+      || (a.key.m_ts == b.key.m_ts && a.key.m_uid < b.key.m_uid);
+  }
+
+  // Moves the last event into slot i and restores the heap
+  void RemoveAt (size_t i)
+  {
+    m_heap[i] = m_heap.back ();
+    m_heap.pop_back ();
+    if (i < m_heap.size ())
+      {
+        SiftDown (i);
+        SiftUp (i);
+      }
+  }
+
+  void SiftUp (size_t i)
+  {
+    Event ev = m_heap[i];
+    while (i > 0)
+      {
+        size_t parent = (i - 1) / ARITY;
+        if (!Less (ev, m_heap[parent]))
+          {
+            break;
+          }
+        m_heap[i] = m_heap[parent];
+        i = parent;
+      }
+    m_heap[i] = ev;
+  }
+
+  void SiftDown (size_t i)
+  {
+    Event ev = m_heap[i];
+    size_t size = m_heap.size ();
+    while (true)
+      {
+        size_t first = i * ARITY + 1;
+        if (first >= size)
+          {
+            break;
+          }
+        size_t last = first + ARITY < size ? first + ARITY : size;
+        size_t best = first;
+        for (size_t c = first + 1; c < last; ++c)
+          {
+            if (Less (m_heap[c], m_heap[best]))
+              {
+                best = c;
+              }
+          }
+        if (!Less (m_heap[best], ev))
+          {
+            break;
+          }
+        m_heap[i] = m_heap[best];
+        i = best;
+      }
+    m_heap[i] = ev;
+  }
+
+  std::vector<Event> m_heap;
+};
+
+NS_OBJECT_ENSURE_REGISTERED (DaryHeapScheduler);
+
+} // namespace ns3
+
+#endif /* LAB_DARY_HEAP_SCHEDULER_H */
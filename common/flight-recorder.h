@@ -0,0 +1,195 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+// Flight-recorder packet capture.
+//
+// Instead of writing every packet of every device to pcap, the recorder
+// keeps the last N packets of each point-to-point device in memory. Nothing
+// is written until Trigger() is called (on an interface change, a loss spike
+// or at a chosen time): then the packets of the last 'pre' seconds are saved
+// and every packet of the next 'post' seconds is written as it is seen.
+// Overlapping windows are merged, and a packet is never written twice. The
+// files are named like those of PointToPointHelper::EnablePcapAll, one per
+// device holding all of its windows:
+//
+//   FlightRecorder recorder ("DynamicRoutingProtocol", 1000, Seconds (0.2), Seconds (0.5));
+//   recorder.Install (devices);
+//   Simulator::Schedule (Seconds (2.0), &FlightRecorder::Trigger, &recorder);
+
+#ifndef LAB_FLIGHT_RECORDER_H
+#define LAB_FLIGHT_RECORDER_H
+
+#include <string>
+#include <vector>
+#include "ns3/core-module.h"
+#include "ns3/network-module.h"
+
+class FlightRecorder
+{
+public:
+  FlightRecorder (std::string prefix, uint32_t packetsPerDevice, ns3::Time pre, ns3::Time post)
+    : m_prefix (prefix),
+      m_capacity (packetsPerDevice > 0 ? packetsPerDevice : 1),
+      m_pre (pre),
+      m_post (post),
+      m_captureUntil (ns3::Seconds (-1)),
+      m_triggers (0),
+      m_seen (0),
+      m_written (0)
+  {
+  }
+
+  ~FlightRecorder ()
+  {
+    for (size_t i = 0; i < m_devices.size (); ++i)
+      {
+        delete m_devices[i];
+      }
+  }
+
+  /**
+   * Starts keeping the packets sent and received by these devices
+   */
+  void Install (const ns3::NetDeviceContainer &devices)
+  {
+    for (uint32_t i = 0; i < devices.GetN (); ++i)
+      {
+        Device *device = new Device;
+        device->recorder = this;
+        device->netDevice = devices.Get (i);
+        device->ring.resize (m_capacity);
+        device->head = 0;
+        device->count = 0;
+        device->lastWritten = ns3::Seconds (-1);
+        m_devices.push_back (device);
+        // The trace source EnablePcap uses
+        devices.Get (i)->TraceConnectWithoutContext ("PromiscSniffer", ns3::MakeBoundCallback (&FlightRecorder::Sniff, device));
+      }
+  }
+
+  /**
+   * Saves the last 'pre' seconds of every device and keeps writing for the
+   * next 'post' seconds
+   */
+  void Trigger (void)
+  {
+    ns3::Time now = ns3::Simulator::Now ();
+    m_triggers++;
+    for (size_t i = 0; i < m_devices.size (); ++i)
+      {
+        Device *device = m_devices[i];
+        uint32_t first = (device->head + m_capacity - device->count) % m_capacity;
+        // The ring is emptied, so a later window cannot save these again
+        for (uint32_t j = 0; j < device->count; ++j)
+          {
+            const Entry &entry = device->ring[(first + j) % m_capacity];
+            if (entry.time >= now - m_pre)
+              {
+                Write (device, entry.time, entry.packet);
+              }
+          }
+        device->count = 0;
+      }
+    if (now + m_post > m_captureUntil)
+      {
+        m_captureUntil = now + m_post;
+      }
+  }
+
+  uint32_t GetTriggers () const
+  {
+    return m_triggers;
+  }
+
+  uint64_t GetSeen () const
+  {
+    return m_seen;
+  }
+
+  uint64_t GetWritten () const
+  {
+    return m_written;
+  }
+
+private:
+  struct Entry
+  {
+    ns3::Time time;
+    ns3::Ptr<const ns3::Packet> packet;
+  };
+
+  struct Device
+  {
+    FlightRecorder *recorder;
+    ns3::Ptr<ns3::NetDevice> netDevice;
+    std::vector<Entry> ring;
+    uint32_t head;              // next slot to fill
+    uint32_t count;             // packets in the ring
+    ns3::Time lastWritten;      // keeps the file in time order
+    ns3::Ptr<ns3::PcapFileWrapper> file;
+  };
+
+  static void Sniff (Device *device, ns3::Ptr<const ns3::Packet> packet)
+  {
+    FlightRecorder *recorder = device->recorder;
+    ns3::Time now = ns3::Simulator::Now ();
+    recorder->m_seen++;
+    if (now <= recorder->m_captureUntil)
+      {
+        recorder->Write (device, now, packet);
+        return;
+      }
+    // The receiving device strips headers off the very same packet, so the
+    // ring keeps a (copy-on-write) copy
+    Entry &entry = device->ring[device->head];
+    entry.time = now;
+    entry.packet = packet->Copy ();
+    device->head = (device->head + 1) % recorder->m_capacity;
+    if (device->count < recorder->m_capacity)
+      {
+        device->count++;
+      }
+  }
+
+  void Write (Device *device, ns3::Time time, ns3::Ptr<const ns3::Packet> packet)
+  {
+    if (time < device->lastWritten)
+      {
+        return;
+      }
+    if (device->file == 0)
+      {
+        ns3::PcapHelper pcapHelper;
+        std::string name = pcapHelper.GetFilenameFromDevice (m_prefix, device->netDevice, true);
+        device->file = pcapHelper.CreateFile (name, std::ios::out, ns3::PcapHelper::DLT_PPP);
+      }
+    device->file->Write (time, packet);
+    device->lastWritten = time;
+    m_written++;
+  }
+
+  std::string m_prefix;
+  uint32_t m_capacity;
+  ns3::Time m_pre;
+  ns3::Time m_post;
+  ns3::Time m_captureUntil;
+  std::vector<Device *> m_devices;
+  uint32_t m_triggers;
+  uint64_t m_seen;
+  uint64_t m_written;
+};
+
+#endif /* LAB_FLIGHT_RECORDER_H */
@@ -0,0 +1,564 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+// FlowMonitor with a hash table flow classifier.
+//
+// Ipv4FlowClassifier looks every packet up in an ordered map of five-tuples,
+// at every probe it passes; with thousands of flows that lookup dominates.
+// HashFlowClassifier keeps the five-tuples in an open-addressing table
+// (linear probing, the hash computed once per lookup) and only calls the
+// stock classifier for the first packet of a flow, so the FlowIds are
+// assigned in the same order, FindFlow () keeps working and existing
+// analysis code does not change:
+//
+//   HashFlowMonitorHelper flowmon (useHash);   // false: the stock helper
+//   Ptr<FlowMonitor> monitor = flowmon.InstallAll ();
+//   ...
+//   Ptr<Ipv4FlowClassifier> classifier = DynamicCast<Ipv4FlowClassifier> (flowmon.GetClassifier ());
+//
+// The stock Ipv4FlowProbe calls Ipv4FlowClassifier::Classify, which is not
+// virtual, so HashFlowProbe takes its place. It reports the same events to
+// the monitor: the first transmission, every forwarding hop, the delivery
+// and the drops with the same reason codes (queue drops included).
+//
+// InstallSelected () puts full probes only on some nodes, by default the
+// flow endpoints (EndpointNodes ()), and on every other node a probe that
+// only reports drops. Transit routers then no longer classify every packet
+// they forward, while packets dropped there are still counted as lost right
+// away, so the end-to-end throughput, delay and loss stay the same; only the
+// per hop statistics (timesForwarded, the per probe stats of transit
+// nodes) are gone. PrintOverhead () tells the probe work and memory a
+// profile costs.
+
+#ifndef LAB_HASH_FLOW_MONITOR_H
+#define LAB_HASH_FLOW_MONITOR_H
+
+#include <iostream>
+#include <vector>
+#include "ns3/core-module.h"
+#include "ns3/network-module.h"
+#include "ns3/internet-module.h"
+#include "ns3/flow-monitor-module.h"
+#include "ns3/point-to-point-module.h"
+
+namespace ns3 {
+
+class HashFlowClassifier : public Ipv4FlowClassifier
+{
+public:
+  /**
+   * Without the table every packet goes through the stock classifier
+   */
+  HashFlowClassifier (bool useTable = true)
+    : m_useTable (useTable),
+      m_used (0)
+  {
+    Entry empty = { 0, 0, 0, 0, 0, 0 };
+    m_table.assign (1024, empty);
+  }
+
+  /**
+   * Same contract as Ipv4FlowClassifier::Classify: false for packets that
+   * are not unicast TCP or UDP, otherwise the flow and the packet id (the IP
+   * identification, as the stock classifier uses).
+   */
+  bool Classify (const Ipv4Header &ipHeader, Ptr<const Packet> ipPayload,
+                 uint32_t *out_flowId, uint32_t *out_packetId)
+  {
+    if (!m_useTable)
+      {
+        return Ipv4FlowClassifier::Classify (ipHeader, ipPayload, out_flowId, out_packetId);
+      }
+    uint8_t protocol = ipHeader.GetProtocol ();
+    if (ipHeader.GetDestination () == Ipv4Address::GetBroadcast ()
+        || (protocol != 6 && protocol != 17) || ipPayload->GetSize () < 4)
+      {
+        return false;
+      }
+    // TCP and UDP both start with the source and destination ports
+    uint8_t ports[4];
+    ipPayload->CopyData (ports, 4);
+    Entry key;
+    key.source = ipHeader.GetSource ().Get ();
+    key.destination = ipHeader.GetDestination ().Get ();
+    key.sourcePort = (ports[0] << 8) | ports[1];
+    key.destinationPort = (ports[2] << 8) | ports[3];
+    key.protocol = protocol;
+
+    size_t mask = m_table.size () - 1;
+    for (size_t i = Hash (key) & mask; ; i = (i + 1) & mask)
+      {
+        Entry &entry = m_table[i];
+        if (entry.flowId == 0)
+          {
+            // First packet of the flow: the stock classifier numbers it
+            uint32_t packetId;
+            if (!Ipv4FlowClassifier::Classify (ipHeader, ipPayload, &key.flowId, &packetId))
+              {
+                return false;
+              }
+            entry = key;
+            if (++m_used * 2 > m_table.size ())
+              {
+                Grow ();
+              }
+            break;
+          }
+        if (entry.source == key.source && entry.destination == key.destination
+            && entry.sourcePort == key.sourcePort && entry.destinationPort == key.destinationPort
+            && entry.protocol == key.protocol)
+          {
+            key.flowId = entry.flowId;
+            break;
+          }
+      }
+    *out_flowId = key.flowId;
+    *out_packetId = ipHeader.GetIdentification ();
+    return true;
+  }
+
+private:
+  // FlowIds start at 1, so 0 marks a free slot
+  struct Entry
+  {
+    uint32_t source;
+    uint32_t destination;
+    uint16_t sourcePort;
+    uint16_t destinationPort;
+    uint8_t protocol;
+    uint32_t flowId;
+  };
+
+  static size_t Hash (const Entry &e)
+  {
+    uint64_t h = (static_cast<uint64_t> (e.source) << 32) ^ e.destination;
+    h ^= (static_cast<uint64_t> (e.sourcePort) << 40) ^ (static_cast<uint64_t> (e.destinationPort) << 16) ^ e.protocol;
+    // 64 bit finalizer of MurmurHash3
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return static_cast<size_t> (h);
+  }
+
+  // Doubles the table once it is half full
+  void Grow ()
+  {
+    std::vector<Entry> old;
+    old.swap (m_table);
+    Entry empty = { 0, 0, 0, 0, 0, 0 };
+    m_table.assign (old.size () * 2, empty);
+    size_t mask = m_table.size () - 1;
+    for (size_t j = 0; j < old.size (); ++j)
+      {
+        if (old[j].flowId == 0)
+          {
+            continue;
+          }
+        size_t i = Hash (old[j]) & mask;
+        while (m_table[i].flowId != 0)
+          {
+            i = (i + 1) & mask;
+          }
+        m_table[i] = old[j];
+      }
+  }
+
+  bool m_useTable;
+  std::vector<Entry> m_table;
+  size_t m_used;
+};
+
+/**
+ * Carries the flow and packet id from the first probe to the queues on the
+ * way, where the IP header is no longer at hand
+ */
+class HashFlowProbeTag : public Tag
+{
+public:
+  static TypeId GetTypeId (void)
+  {
+    static TypeId tid = TypeId ("ns3::HashFlowProbeTag")
+      .SetParent<Tag> ()
+      .AddConstructor<HashFlowProbeTag> ()
+    ;
+    return tid;
+  }
+
+  virtual TypeId GetInstanceTypeId (void) const
+  {
+    return GetTypeId ();
+  }
+
+  HashFlowProbeTag ()
+    : flowId (0),
+      packetId (0),
+      packetSize (0)
+  {
+  }
+
+  virtual uint32_t GetSerializedSize (void) const
+  {
+    return 12;
+  }
+
+  virtual void Serialize (TagBuffer i) const
+  {
+    i.WriteU32 (flowId);
+    i.WriteU32 (packetId);
+    i.WriteU32 (packetSize);
+  }
+
+  virtual void Deserialize (TagBuffer i)
+  {
+    flowId = i.ReadU32 ();
+    packetId = i.ReadU32 ();
+    packetSize = i.ReadU32 ();
+  }
+
+  virtual void Print (std::ostream &os) const
+  {
+    os << "flow=" << flowId << " packet=" << packetId << " size=" << packetSize;
+  }
+
+  uint32_t flowId;
+  uint32_t packetId;
+  uint32_t packetSize;
+};
+
+class HashFlowProbe : public FlowProbe
+{
+public:
+  /**
+   * With dropsOnly the probe only reports the packets dropped at this node
+   */
+  HashFlowProbe (Ptr<FlowMonitor> monitor, Ptr<HashFlowClassifier> classifier, Ptr<Node> node, bool dropsOnly = false)
+    : FlowProbe (monitor),
+      m_classifier (classifier)
+  {
+    Ptr<Ipv4L3Protocol> ipv4 = node->GetObject<Ipv4L3Protocol> ();
+    if (!dropsOnly)
+      {
+        ipv4->TraceConnectWithoutContext ("SendOutgoing", MakeCallback (&HashFlowProbe::SendOutgoing, Ptr<HashFlowProbe> (this)));
+        ipv4->TraceConnectWithoutContext ("UnicastForward", MakeCallback (&HashFlowProbe::Forward, Ptr<HashFlowProbe> (this)));
+        ipv4->TraceConnectWithoutContext ("LocalDeliver", MakeCallback (&HashFlowProbe::LocalDeliver, Ptr<HashFlowProbe> (this)));
+      }
+    ipv4->TraceConnectWithoutContext ("Drop", MakeCallback (&HashFlowProbe::Drop, Ptr<HashFlowProbe> (this)));
+    for (uint32_t d = 0; d < node->GetNDevices (); ++d)
+      {
+        Ptr<PointToPointNetDevice> device = DynamicCast<PointToPointNetDevice> (node->GetDevice (d));
+        if (device != 0)
+          {
+            device->GetQueue ()->TraceConnectWithoutContext ("Drop", MakeCallback (&HashFlowProbe::QueueDrop, Ptr<HashFlowProbe> (this)));
+          }
+      }
+  }
+
+private:
+  void SendOutgoing (const Ipv4Header &ipHeader, Ptr<const Packet> ipPayload, uint32_t interface)
+  {
+    uint32_t flowId, packetId;
+    if (m_classifier->Classify (ipHeader, ipPayload, &flowId, &packetId))
+      {
+        uint32_t size = ipPayload->GetSize () + ipHeader.GetSerializedSize ();
+        m_flowMonitor->ReportFirstTx (this, flowId, packetId, size);
+        HashFlowProbeTag tag;
+        tag.flowId = flowId;
+        tag.packetId = packetId;
+        tag.packetSize = size;
+        ipPayload->AddPacketTag (tag);
+      }
+  }
+
+  void Forward (const Ipv4Header &ipHeader, Ptr<const Packet> ipPayload, uint32_t interface)
+  {
+    uint32_t flowId, packetId;
+    if (m_classifier->Classify (ipHeader, ipPayload, &flowId, &packetId))
+      {
+        m_flowMonitor->ReportForwarding (this, flowId, packetId, ipPayload->GetSize () + ipHeader.GetSerializedSize ());
+      }
+  }
+
+  void LocalDeliver (const Ipv4Header &ipHeader, Ptr<const Packet> ipPayload, uint32_t interface)
+  {
+    uint32_t flowId, packetId;
+    if (m_classifier->Classify (ipHeader, ipPayload, &flowId, &packetId))
+      {
+        m_flowMonitor->ReportLastRx (this, flowId, packetId, ipPayload->GetSize () + ipHeader.GetSerializedSize ());
+        // The applications get the packet without the tag
+        HashFlowProbeTag tag;
+        ConstCast<Packet> (ipPayload)->RemovePacketTag (tag);
+      }
+  }
+
+  void Drop (const Ipv4Header &ipHeader, Ptr<const Packet> ipPayload, Ipv4L3Protocol::DropReason reason,
+             Ptr<Ipv4> ipv4, uint32_t interface)
+  {
+    uint32_t flowId, packetId;
+    if (!m_classifier->Classify (ipHeader, ipPayload, &flowId, &packetId))
+      {
+        return;
+      }
+    Ipv4FlowProbe::DropReason code;
+    switch (reason)
+      {
+      case Ipv4L3Protocol::DROP_TTL_EXPIRED:
+        code = Ipv4FlowProbe::DROP_TTL_EXPIRE;
+        break;
+      case Ipv4L3Protocol::DROP_NO_ROUTE:
+        code = Ipv4FlowProbe::DROP_NO_ROUTE;
+        break;
+      case Ipv4L3Protocol::DROP_BAD_CHECKSUM:
+        code = Ipv4FlowProbe::DROP_BAD_CHECKSUM;
+        break;
+      case Ipv4L3Protocol::DROP_INTERFACE_DOWN:
+        code = Ipv4FlowProbe::DROP_INTERFACE_DOWN;
+        break;
+      case Ipv4L3Protocol::DROP_ROUTE_ERROR:
+        code = Ipv4FlowProbe::DROP_ROUTE_ERROR;
+        break;
+      default:
+        code = Ipv4FlowProbe::DROP_INVALID_REASON;
+        break;
+      }
+    m_flowMonitor->ReportDrop (this, flowId, packetId, ipPayload->GetSize () + ipHeader.GetSerializedSize (), code);
+  }
+
+  void QueueDrop (Ptr<const Packet> packet)
+  {
+    HashFlowProbeTag tag;
+    if (packet->PeekPacketTag (tag))
+      {
+        m_flowMonitor->ReportDrop (this, tag.flowId, tag.packetId, tag.packetSize, Ipv4FlowProbe::DROP_QUEUE);
+      }
+  }
+
+  Ptr<HashFlowClassifier> m_classifier;
+};
+
+/**
+ * FlowMonitorHelper with the hash classifier, or the stock helper itself
+ * when created with useHash = false (except for InstallSelected (), which
+ * always needs HashFlowProbe and then uses the stock classification)
+ */
+class HashFlowMonitorHelper
+{
+public:
+  HashFlowMonitorHelper (bool useHash = true)
+    : m_useHash (useHash),
+      m_own (useHash),
+      m_probes (0),
+      m_dropProbes (0)
+  {
+  }
+
+  /**
+   * For a helper that has to exist before the options are parsed; call it
+   * before installing anything
+   */
+  void SetUseHash (bool useHash)
+  {
+    m_useHash = useHash;
+    m_own = useHash;
+  }
+
+  Ptr<FlowMonitor> Install (Ptr<Node> node)
+  {
+    if (!m_own)
+      {
+        return m_stock.Install (node);
+      }
+    return AddProbe (node, false);
+  }
+
+  Ptr<FlowMonitor> Install (NodeContainer nodes)
+  {
+    for (NodeContainer::Iterator i = nodes.Begin (); i != nodes.End (); ++i)
+      {
+        Install (*i);
+      }
+    return GetMonitor ();
+  }
+
+  Ptr<FlowMonitor> InstallAll ()
+  {
+    return Install (NodeContainer::GetGlobal ());
+  }
+
+  /**
+   * Full probes on 'probed', probes that only report drops on every other
+   * node. Call it instead of, not after, the other Install methods.
+   */
+  Ptr<FlowMonitor> InstallSelected (NodeContainer probed)
+  {
+    m_own = true;
+    NodeContainer all = NodeContainer::GetGlobal ();
+    for (NodeContainer::Iterator i = all.Begin (); i != all.End (); ++i)
+      {
+        bool full = false;
+        for (NodeContainer::Iterator j = probed.Begin (); j != probed.End () && !full; ++j)
+          {
+            full = *i == *j;
+          }
+        AddProbe (*i, !full);
+      }
+    return GetMonitor ();
+  }
+
+  /**
+   * The nodes the applications run on and the nodes owning the addresses
+   * they send to (their "Remote" or "RemoteAddress" attribute)
+   */
+  static NodeContainer EndpointNodes (void)
+  {
+    NodeContainer all = NodeContainer::GetGlobal ();
+    std::vector<bool> endpoint (all.GetN (), false);
+    for (uint32_t n = 0; n < all.GetN (); ++n)
+      {
+        Ptr<Node> node = all.Get (n);
+        for (uint32_t a = 0; a < node->GetNApplications (); ++a)
+          {
+            endpoint[n] = true;
+            Ptr<Application> app = node->GetApplication (a);
+            AddressValue remote;
+            if (!app->GetAttributeFailSafe ("Remote", remote) && !app->GetAttributeFailSafe ("RemoteAddress", remote))
+              {
+                continue;
+              }
+            Ipv4Address destination;
+            if (InetSocketAddress::IsMatchingType (remote.Get ()))
+              {
+                destination = InetSocketAddress::ConvertFrom (remote.Get ()).GetIpv4 ();
+              }
+            else if (Ipv4Address::IsMatchingType (remote.Get ()))
+              {
+                destination = Ipv4Address::ConvertFrom (remote.Get ());
+              }
+            else
+              {
+                continue;
+              }
+            for (uint32_t m = 0; m < all.GetN (); ++m)
+              {
+                Ptr<Ipv4> ipv4 = all.Get (m)->GetObject<Ipv4> ();
+                if (ipv4 != 0 && ipv4->GetInterfaceForAddress (destination) >= 0)
+                  {
+                    endpoint[m] = true;
+                  }
+              }
+          }
+      }
+    NodeContainer endpoints;
+    for (uint32_t n = 0; n < all.GetN (); ++n)
+      {
+        if (endpoint[n])
+          {
+            endpoints.Add (all.Get (n));
+          }
+      }
+    return endpoints;
+  }
+
+  Ptr<FlowMonitor> GetMonitor ()
+  {
+    if (!m_own)
+      {
+        return m_stock.GetMonitor ();
+      }
+    if (m_monitor == 0)
+      {
+        m_classifier = Create<HashFlowClassifier> (m_useHash);
+        m_monitor = CreateObject<FlowMonitor> ();
+        m_monitor->SetFlowClassifier (m_classifier);
+      }
+    return m_monitor;
+  }
+
+  Ptr<FlowClassifier> GetClassifier ()
+  {
+    if (!m_own)
+      {
+        return m_stock.GetClassifier ();
+      }
+    GetMonitor ();
+    return m_classifier;
+  }
+
+  /**
+   * Work and memory of the probes: the packet reports they handled (each a
+   * classification and a stats update) and their per flow stats entries
+   */
+  void PrintOverhead (std::ostream &os)
+  {
+    std::vector<Ptr<FlowProbe> > probes = GetMonitor ()->GetAllProbes ();
+    uint64_t reports = 0;
+    uint64_t entries = 0;
+    for (size_t p = 0; p < probes.size (); ++p)
+      {
+        FlowProbe::Stats stats = probes[p]->GetStats ();
+        entries += stats.size ();
+        for (FlowProbe::Stats::const_iterator i = stats.begin (); i != stats.end (); ++i)
+          {
+            reports += i->second.packets;
+            for (size_t r = 0; r < i->second.packetsDropped.size (); ++r)
+              {
+                reports += i->second.packetsDropped[r];
+              }
+          }
+      }
+    os << "Flow monitor: " << probes.size () << " probes";
+    if (m_dropProbes > 0)
+      {
+        os << " (" << m_probes << " full, " << m_dropProbes << " drops only)";
+      }
+    os << ", " << reports << " packet reports, " << entries << " per probe flow entries (~"
+       << entries * (sizeof (FlowProbe::FlowStats) + 4 * sizeof (void *)) / 1024 << " KiB)\n";
+  }
+
+private:
+  Ptr<FlowMonitor> AddProbe (Ptr<Node> node, bool dropsOnly)
+  {
+    Ptr<FlowMonitor> monitor = GetMonitor ();
+    if (node->GetObject<Ipv4L3Protocol> () != 0)
+      {
+        Ptr<HashFlowProbe> probe = Create<HashFlowProbe> (monitor, m_classifier, node, dropsOnly);
+        if (dropsOnly)
+          {
+            m_dropProbes++;
+          }
+        else
+          {
+            m_probes++;
+          }
+      }
+    return monitor;
+  }
+
+  bool m_useHash;
+  bool m_own;           // HashFlowProbe rather than the stock helper
+  FlowMonitorHelper m_stock;
+  Ptr<FlowMonitor> m_monitor;
+  Ptr<HashFlowClassifier> m_classifier;
+  uint32_t m_probes;
+  uint32_t m_dropProbes;
+};
+
+NS_OBJECT_ENSURE_REGISTERED (HashFlowProbeTag);
+
+} // namespace ns3
+
+#endif /* LAB_HASH_FLOW_MONITOR_H */
@@ -0,0 +1,372 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+// Per-hop latency of the packets crossing point-to-point links.
+//
+// Every packet handed to a point-to-point device gets a HopTag. At each hop
+// the tag notes the node, the time the packet waited in the device queue
+// (MacTx to PhyTxBegin) and the time from the start of its transmission to
+// the next node (transmission, propagation and forwarding, PhyTxBegin to the
+// next MacTx or to the local delivery). When IP delivers the packet, the
+// HopLatency collector adds the hops to the histograms of its path, the
+// sequence of nodes it went through:
+//
+//   HopLatency hops;
+//   hops.Install (nodes);
+//   ...
+//   Simulator::Run ();
+//   hops.Print (std::cout);
+//
+// The tag is 20 bytes: hop count, last event time in microseconds and three
+// hops of node, queueing and wire time in units of 10us (up to 655ms). Hops
+// after the third are counted but not kept. The path table and its
+// histograms are allocated when the collector is created, so collecting
+// does not allocate.
+
+#ifndef LAB_HOP_LATENCY_H
+#define LAB_HOP_LATENCY_H
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include "ns3/core-module.h"
+#include "ns3/network-module.h"
+#include "ns3/internet-module.h"
+#include "ns3/point-to-point-module.h"
+#include "latency-histogram.h"
+
+namespace ns3 {
+
+class HopTag : public Tag
+{
+public:
+  static const uint32_t MAX_HOPS = 3;
+
+  static TypeId GetTypeId (void)
+  {
+    static TypeId tid = TypeId ("ns3::HopTag")
+      .SetParent<Tag> ()
+      .AddConstructor<HopTag> ()
+    ;
+    return tid;
+  }
+
+  virtual TypeId GetInstanceTypeId (void) const
+  {
+    return GetTypeId ();
+  }
+
+  HopTag ()
+    : m_count (0),
+      m_lastEventUs (0)
+  {
+    for (uint32_t i = 0; i < MAX_HOPS; ++i)
+      {
+        m_node[i] = 0;
+        m_queue[i] = 0;
+        m_wire[i] = 0;
+      }
+  }
+
+  virtual uint32_t GetSerializedSize (void) const
+  {
+    return 1 + 4 + MAX_HOPS * (1 + 2 + 2);
+  }
+
+  virtual void Serialize (TagBuffer i) const
+  {
+    i.WriteU8 (m_count);
+    i.WriteU32 (m_lastEventUs);
+    for (uint32_t h = 0; h < MAX_HOPS; ++h)
+      {
+        i.WriteU8 (m_node[h]);
+        i.WriteU16 (m_queue[h]);
+        i.WriteU16 (m_wire[h]);
+      }
+  }
+
+  virtual void Deserialize (TagBuffer i)
+  {
+    m_count = i.ReadU8 ();
+    m_lastEventUs = i.ReadU32 ();
+    for (uint32_t h = 0; h < MAX_HOPS; ++h)
+      {
+        m_node[h] = i.ReadU8 ();
+        m_queue[h] = i.ReadU16 ();
+        m_wire[h] = i.ReadU16 ();
+      }
+  }
+
+  virtual void Print (std::ostream &os) const
+  {
+    os << "hops=" << static_cast<uint32_t> (m_count);
+    for (uint32_t h = 0; h < m_count && h < MAX_HOPS; ++h)
+      {
+        os << " n" << static_cast<uint32_t> (m_node[h]) << " q=" << m_queue[h] * 10 << "us w=" << m_wire[h] * 10 << "us";
+      }
+  }
+
+  uint8_t m_count;              // hops started, may be more than MAX_HOPS
+  uint32_t m_lastEventUs;       // MacTx or PhyTxBegin of the current hop
+  uint8_t m_node[MAX_HOPS];
+  uint16_t m_queue[MAX_HOPS];   // 10us units
+  uint16_t m_wire[MAX_HOPS];    // 10us units
+};
+
+class HopLatency
+{
+public:
+  HopLatency (uint32_t maxPaths = 8)
+    : m_paths (maxPaths),
+      m_pathCount (0),
+      m_unclassified (0)
+  {
+  }
+
+  ~HopLatency ()
+  {
+    for (size_t i = 0; i < m_hooks.size (); ++i)
+      {
+        delete m_hooks[i];
+      }
+  }
+
+  /**
+   * Tags the packets of every point-to-point device of these nodes and
+   * collects those delivered to them
+   */
+  void Install (NodeContainer nodes)
+  {
+    for (uint32_t n = 0; n < nodes.GetN (); ++n)
+      {
+        Ptr<Node> node = nodes.Get (n);
+        Hook *hook = new Hook;
+        hook->collector = this;
+        hook->node = static_cast<uint8_t> (node->GetId ());
+        m_hooks.push_back (hook);
+        for (uint32_t d = 0; d < node->GetNDevices (); ++d)
+          {
+            Ptr<PointToPointNetDevice> device = DynamicCast<PointToPointNetDevice> (node->GetDevice (d));
+            if (device != 0)
+              {
+                device->TraceConnectWithoutContext ("MacTx", MakeBoundCallback (&HopLatency::MacTx, hook));
+                device->TraceConnectWithoutContext ("PhyTxBegin", MakeBoundCallback (&HopLatency::PhyTxBegin, hook));
+              }
+          }
+        Ptr<Ipv4L3Protocol> ipv4 = node->GetObject<Ipv4L3Protocol> ();
+        if (ipv4 != 0)
+          {
+            ipv4->TraceConnectWithoutContext ("LocalDeliver", MakeBoundCallback (&HopLatency::LocalDeliver, hook));
+          }
+      }
+  }
+
+  /**
+   * One block per path: packets, end-to-end percentiles and per hop
+   * queueing and wire percentiles, in ms
+   */
+  void Print (std::ostream &os) const
+  {
+    os << std::fixed << std::setprecision (3);
+    for (uint32_t p = 0; p < m_pathCount; ++p)
+      {
+        const Path &path = m_paths[p];
+        os << "Path ";
+        for (uint32_t h = 0; h < path.hops; ++h)
+          {
+            os << "n" << static_cast<uint32_t> (path.node[h]) << " > ";
+          }
+        os << "n" << static_cast<uint32_t> (path.destination) << ": " << path.total.GetCount () << " packets, delay p50 "
+           << path.total.ValueAtPercentile (50) / 1e6 << " ms, p99 " << path.total.ValueAtPercentile (99) / 1e6 << " ms\n";
+        for (uint32_t h = 0; h < path.hops; ++h)
+          {
+            os << "  hop n" << static_cast<uint32_t> (path.node[h])
+               << "  queue p50 " << std::setw (8) << path.queue[h].ValueAtPercentile (50) / 1e6
+               << "  p99 " << std::setw (8) << path.queue[h].ValueAtPercentile (99) / 1e6
+               << "  wire p50 " << std::setw (8) << path.wire[h].ValueAtPercentile (50) / 1e6
+               << "  p99 " << std::setw (8) << path.wire[h].ValueAtPercentile (99) / 1e6 << "\n";
+          }
+      }
+    os.unsetf (std::ios::floatfield);
+    if (m_unclassified > 0)
+      {
+        os << m_unclassified << " packets on longer or further paths were not classified\n";
+      }
+  }
+
+private:
+  struct Hook
+  {
+    HopLatency *collector;
+    uint8_t node;
+  };
+
+  struct Path
+  {
+    Path ()
+      : hops (0),
+        destination (0),
+        total (6)
+    {
+      for (uint32_t h = 0; h < HopTag::MAX_HOPS; ++h)
+        {
+          node[h] = 0;
+          queue[h] = LatencyHistogram (6);
+          wire[h] = LatencyHistogram (6);
+        }
+    }
+
+    uint32_t hops;
+    uint8_t node[HopTag::MAX_HOPS];
+    uint8_t destination;
+    LatencyHistogram total;
+    LatencyHistogram queue[HopTag::MAX_HOPS];
+    LatencyHistogram wire[HopTag::MAX_HOPS];
+  };
+
+  static uint32_t NowUs (void)
+  {
+    return static_cast<uint32_t> (Simulator::Now ().GetMicroSeconds ());
+  }
+
+  // Microseconds to 10us units, saturating
+  static uint16_t Units (uint32_t us)
+  {
+    return us / 10 > 0xffff ? 0xffff : static_cast<uint16_t> (us / 10);
+  }
+
+  // The tag is replaced in place: packet tags cannot be changed
+  static void Update (Ptr<const Packet> packet, const HopTag &tag)
+  {
+    HopTag old;
+    ConstCast<Packet> (packet)->RemovePacketTag (old);
+    packet->AddPacketTag (tag);
+  }
+
+  // The packet reached a device: the hop before it (if any) ends, a new one starts
+  static void MacTx (Hook *hook, Ptr<const Packet> packet)
+  {
+    HopTag tag;
+    packet->PeekPacketTag (tag);
+    uint32_t now = NowUs ();
+    if (tag.m_count > 0 && tag.m_count <= HopTag::MAX_HOPS)
+      {
+        tag.m_wire[tag.m_count - 1] = Units (now - tag.m_lastEventUs);
+      }
+    if (tag.m_count < HopTag::MAX_HOPS)
+      {
+        tag.m_node[tag.m_count] = hook->node;
+      }
+    if (tag.m_count < 0xff)
+      {
+        tag.m_count++;
+      }
+    tag.m_lastEventUs = now;
+    Update (packet, tag);
+  }
+
+  // The device starts sending it: the queueing of this hop ends
+  static void PhyTxBegin (Hook *hook, Ptr<const Packet> packet)
+  {
+    HopTag tag;
+    if (!packet->PeekPacketTag (tag))
+      {
+        return;
+      }
+    uint32_t now = NowUs ();
+    if (tag.m_count > 0 && tag.m_count <= HopTag::MAX_HOPS)
+      {
+        tag.m_queue[tag.m_count - 1] = Units (now - tag.m_lastEventUs);
+      }
+    tag.m_lastEventUs = now;
+    Update (packet, tag);
+  }
+
+  static void LocalDeliver (Hook *hook, const Ipv4Header &header, Ptr<const Packet> packet, uint32_t interface)
+  {
+    HopTag tag;
+    if (!packet->PeekPacketTag (tag) || tag.m_count == 0)
+      {
+        return;
+      }
+    HopLatency *collector = hook->collector;
+    if (tag.m_count > HopTag::MAX_HOPS)
+      {
+        collector->m_unclassified++;
+        return;
+      }
+    tag.m_wire[tag.m_count - 1] = Units (NowUs () - tag.m_lastEventUs);
+    Path *path = collector->FindPath (tag, hook->node);
+    if (path == 0)
+      {
+        collector->m_unclassified++;
+        return;
+      }
+    uint64_t total = 0;
+    for (uint32_t h = 0; h < tag.m_count; ++h)
+      {
+        path->queue[h].Record (tag.m_queue[h] * 10000ull);
+        path->wire[h].Record (tag.m_wire[h] * 10000ull);
+        total += (tag.m_queue[h] + tag.m_wire[h]) * 10000ull;
+      }
+    path->total.Record (total);
+  }
+
+  // The path of these hops, added if there is still room; 0 if the table is full
+  Path *FindPath (const HopTag &tag, uint8_t destination)
+  {
+    for (uint32_t p = 0; p < m_pathCount; ++p)
+      {
+        Path &path = m_paths[p];
+        if (path.hops != tag.m_count || path.destination != destination)
+          {
+            continue;
+          }
+        bool same = true;
+        for (uint32_t h = 0; h < path.hops && same; ++h)
+          {
+            same = path.node[h] == tag.m_node[h];
+          }
+        if (same)
+          {
+            return &path;
+          }
+      }
+    if (m_pathCount == m_paths.size ())
+      {
+        return 0;
+      }
+    Path &path = m_paths[m_pathCount++];
+    path.hops = tag.m_count;
+    path.destination = destination;
+    for (uint32_t h = 0; h < path.hops; ++h)
+      {
+        path.node[h] = tag.m_node[h];
+      }
+    return &path;
+  }
+
+  std::vector<Path> m_paths;
+  uint32_t m_pathCount;
+  uint64_t m_unclassified;
+  std::vector<Hook *> m_hooks;
+};
+
+NS_OBJECT_ENSURE_REGISTERED (HopTag);
+
+} // namespace ns3
+
+#endif /* LAB_HOP_LATENCY_H */
@@ -0,0 +1,79 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+// Logging shared by the lab programs.
+//
+// Every program takes --verbosity:
+//
+//   0  quiet (the default): nothing is logged
+//   1  progress: the program's own NS_LOG_INFO messages
+//   2  packets: additionally one line per packet, from the program's trace
+//      hooks (LAB_PACKET_LOG) and from the ns-3 applications it uses
+//
+// Per-packet messages of the programs go through LAB_PACKET_LOG. It compiles
+// to nothing when LAB_PACKET_LOGGING is 0, which is the default for builds
+// without NS_LOG support (./waf configure -d optimized); pass
+// -DLAB_PACKET_LOGGING=0 to strip them from a debug build as well.
+
+#ifndef LAB_LOG_H
+#define LAB_LOG_H
+
+#include "ns3/core-module.h"
+
+#ifndef LAB_PACKET_LOGGING
+#ifdef NS3_LOG_ENABLE
+#define LAB_PACKET_LOGGING 1
+#else
+#define LAB_PACKET_LOGGING 0
+#endif
+#endif
+
+#if LAB_PACKET_LOGGING
+#define LAB_PACKET_LOG(msg) NS_LOG_LOGIC (msg)
+#else
+#define LAB_PACKET_LOG(msg)
+#endif
+
+enum LabVerbosity
+{
+  LAB_QUIET = 0,
+  LAB_PROGRESS = 1,
+  LAB_PACKETS = 2
+};
+
+/**
+ * Enables the log components for a verbosity level. 'program' is the
+ * NS_LOG_COMPONENT_DEFINE name of the program, 'packetComponents' a
+ * 0-terminated list of ns-3 components that log every packet, or 0.
+ */
+inline void
+EnableLabLogging (uint32_t verbosity, const char *program, const char *const *packetComponents)
+{
+  if (verbosity >= LAB_PACKETS)
+    {
+      ns3::LogComponentEnable (program, ns3::LOG_LEVEL_LOGIC);
+      for (uint32_t i = 0; packetComponents && packetComponents[i]; ++i)
+        {
+          ns3::LogComponentEnable (packetComponents[i], ns3::LOG_LEVEL_INFO);
+        }
+    }
+  else if (verbosity >= LAB_PROGRESS)
+    {
+      ns3::LogComponentEnable (program, ns3::LOG_LEVEL_INFO);
+    }
+}
+
+#endif /* LAB_LOG_H */
@@ -0,0 +1,179 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+// Latency histogram with log-linear buckets (in the style of HdrHistogram).
+//
+// Values are non-negative integers, e.g. nanoseconds. Values below
+// 2^subBucketBits get a bucket each; above that every power of two is split
+// into 2^(subBucketBits-1) equal buckets, so a value is reported within a
+// relative error of 2^-(subBucketBits-1) (0.8% with the default of 8 bits).
+// The memory is fixed when the histogram is created and recording a value is
+// a count-leading-zeros and an increment, however many values are recorded.
+
+#ifndef LAB_LATENCY_HISTOGRAM_H
+#define LAB_LATENCY_HISTOGRAM_H
+
+#include <cstddef>
+#include <vector>
+#include <stdint.h>
+
+class LatencyHistogram
+{
+public:
+  LatencyHistogram (uint32_t subBucketBits = 8)
+    : m_subBits (subBucketBits),
+      m_count (0),
+      m_min (0),
+      m_max (0),
+      m_sum (0)
+  {
+    // Direct buckets, then one half-size group per remaining power of two
+    m_counts.resize ((1u << m_subBits) + (64 - m_subBits) * (1u << (m_subBits - 1)), 0);
+  }
+
+  void Record (uint64_t value)
+  {
+    m_counts[Index (value)]++;
+    if (m_count == 0 || value < m_min)
+      {
+        m_min = value;
+      }
+    if (value > m_max)
+      {
+        m_max = value;
+      }
+    m_count++;
+    m_sum += value;
+  }
+
+  /**
+   * Adds the counts of another histogram with the same bucket layout.
+   */
+  void Merge (const LatencyHistogram &other)
+  {
+    if (other.m_count == 0 || other.m_subBits != m_subBits)
+      {
+        return;
+      }
+    for (size_t i = 0; i < m_counts.size (); ++i)
+      {
+        m_counts[i] += other.m_counts[i];
+      }
+    if (m_count == 0 || other.m_min < m_min)
+      {
+        m_min = other.m_min;
+      }
+    if (other.m_max > m_max)
+      {
+        m_max = other.m_max;
+      }
+    m_count += other.m_count;
+    m_sum += other.m_sum;
+  }
+
+  void Reset ()
+  {
+    m_counts.assign (m_counts.size (), 0);
+    m_count = 0;
+    m_min = 0;
+    m_max = 0;
+    m_sum = 0;
+  }
+
+  uint64_t GetCount () const
+  {
+    return m_count;
+  }
+
+  uint64_t GetMin () const
+  {
+    return m_min;
+  }
+
+  uint64_t GetMax () const
+  {
+    return m_max;
+  }
+
+  double GetMean () const
+  {
+    return m_count ? static_cast<double> (m_sum) / m_count : 0;
+  }
+
+  /**
+   * Smallest bucket value such that at least 'percentile' (0..100) percent
+   * of the recorded values are not above it; never more than the maximum.
+   */
+  uint64_t ValueAtPercentile (double percentile) const
+  {
+    if (m_count == 0)
+      {
+        return 0;
+      }
+    uint64_t wanted = static_cast<uint64_t> (percentile / 100.0 * m_count + 0.5);
+    if (wanted == 0)
+      {
+        wanted = 1;
+      }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < m_counts.size (); ++i)
+      {
+        seen += m_counts[i];
+        if (seen >= wanted)
+          {
+            uint64_t value = HighestInBucket (i);
+            return value < m_max ? value : m_max;
+          }
+      }
+    return m_max;
+  }
+
+private:
+  size_t Index (uint64_t value) const
+  {
+    uint64_t direct = 1ull << m_subBits;
+    if (value < direct)
+      {
+        return value;
+      }
+    uint32_t msb = 63 - __builtin_clzll (value);
+    uint32_t shift = msb - m_subBits + 1;
+    uint64_t half = direct >> 1;
+    return direct + (shift - 1) * half + ((value >> shift) - half);
+  }
+
+  uint64_t HighestInBucket (size_t index) const
+  {
+    uint64_t direct = 1ull << m_subBits;
+    if (index < direct)
+      {
+        return index;
+      }
+    uint64_t half = direct >> 1;
+    uint32_t shift = (index - direct) / half + 1;
+    uint64_t sub = (index - direct) % half + half;
+    return ((sub + 1) << shift) - 1;
+  }
+
+  uint32_t m_subBits;
+  std::vector<uint64_t> m_counts;
+  uint64_t m_count;
+  uint64_t m_min;
+  uint64_t m_max;
+  uint64_t m_sum;
+};
+
+#endif /* LAB_LATENCY_HISTOGRAM_H */
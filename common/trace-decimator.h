@@ -0,0 +1,145 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+// Decimation of trace output.
+//
+// A trace hook keeps updating its own state for every event, but asks its
+// TraceDecimator whether the event should also be written out. One decimator
+// is kept per output stream, so every stream is thinned independently:
+//
+//   all       every event is written (the default)
+//   nth       every N-th event is written
+//   interval  at most one event per interval seconds is written
+//   change    an event is written only if its value differs from the last
+//             written one
+
+#ifndef LAB_TRACE_DECIMATOR_H
+#define LAB_TRACE_DECIMATOR_H
+
+#include <string>
+#include <stdint.h>
+
+class TraceDecimator
+{
+public:
+  enum Mode
+  {
+    ALL,
+    EVERY_NTH,
+    INTERVAL,
+    CHANGE_ONLY
+  };
+
+  TraceDecimator ()
+    : m_mode (ALL),
+      m_n (1),
+      m_interval (0),
+      m_seen (0),
+      m_passed (0),
+      m_lastTime (0),
+      m_lastValue (0)
+  {
+  }
+
+  /**
+   * Parses the name of a mode as given on the command line.
+   * Returns false if the name is not known.
+   */
+  static bool ParseMode (const std::string &name, Mode &mode)
+  {
+    if (name == "all")
+      {
+        mode = ALL;
+      }
+    else if (name == "nth")
+      {
+        mode = EVERY_NTH;
+      }
+    else if (name == "interval")
+      {
+        mode = INTERVAL;
+      }
+    else if (name == "change")
+      {
+        mode = CHANGE_ONLY;
+      }
+    else
+      {
+        return false;
+      }
+    return true;
+  }
+
+  void Configure (Mode mode, uint32_t n, double interval)
+  {
+    m_mode = mode;
+    m_n = n > 0 ? n : 1;
+    m_interval = interval;
+  }
+
+  /**
+   * Returns true if the event at time 'now' (seconds) carrying 'value'
+   * should be passed on to the sink.
+   */
+  bool Accept (double now, double value)
+  {
+    bool pass;
+    switch (m_mode)
+      {
+      case EVERY_NTH:
+        pass = (m_seen % m_n) == 0;
+        break;
+      case INTERVAL:
+        pass = m_passed == 0 || now - m_lastTime >= m_interval;
+        break;
+      case CHANGE_ONLY:
+        pass = m_passed == 0 || value != m_lastValue;
+        break;
+      default:
+        pass = true;
+        break;
+      }
+    m_seen++;
+    if (pass)
+      {
+        m_passed++;
+        m_lastTime = now;
+        m_lastValue = value;
+      }
+    return pass;
+  }
+
+  uint64_t GetSeen () const
+  {
+    return m_seen;
+  }
+
+  uint64_t GetPassed () const
+  {
+    return m_passed;
+  }
+
+private:
+  Mode m_mode;
+  uint32_t m_n;
+  double m_interval;
+  uint64_t m_seen;
+  uint64_t m_passed;
+  double m_lastTime;
+  double m_lastValue;
+};
+
+#endif /* LAB_TRACE_DECIMATOR_H */
@@ -0,0 +1,338 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+// Trace output that does not block the simulator.
+//
+// Trace hooks hand small fixed-size records to a TraceWriter instead of
+// writing to an ofstream. In asynchronous mode the records go through a
+// single-producer/single-consumer lock-free ring to a background thread,
+// which formats them with the formatter of their stream and does all the
+// file I/O. In synchronous mode the record is formatted and written right
+// away, which gives exactly the same files.
+//
+// A stream can also be a slice of a binary .col file (common/column-trace.h)
+// instead of a text file; the hooks do not need to know which.
+//
+// If the ring is full the simulator thread waits for the writer (nothing is
+// lost); how often that happened is part of the statistics Stop() prints to
+// stderr, so the output of the programs stays the same.
+// Call Stop() once the simulation is over, e.g. from
+// Simulator::ScheduleDestroy (&TraceWriter::Stop, &writer).
+
+#ifndef LAB_TRACE_WRITER_H
+#define LAB_TRACE_WRITER_H
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "column-trace.h"
+
+/**
+ * One trace event. What the fields mean, and how they are printed, is up to
+ * the formatter of the stream.
+ */
+struct TraceRecord
+{
+  double time;
+  double real;
+  int64_t integer;
+  uint32_t stream;
+  uint32_t tag;
+};
+
+typedef void (*TraceFormatter) (std::ostream &os, const TraceRecord &record);
+
+/**
+ * Where the records of a binary stream go: the row gets the stream's flow,
+ * event 'event + tag' and either the integer or the real field as value.
+ */
+struct TraceColumnSink
+{
+  ColumnTraceWriter *file;
+  uint32_t flow;
+  uint32_t event;
+  bool real;
+};
+
+class TraceWriter
+{
+public:
+  /**
+   * \param capacity ring size in records, rounded up to a power of two
+   */
+  TraceWriter (uint32_t capacity = 65536)
+    : m_async (false),
+      m_running (false),
+      m_head (0),
+      m_tail (0),
+      m_stop (0),
+      m_records (0),
+      m_fullWaits (0),
+      m_highWater (0)
+  {
+    uint32_t size = 1;
+    while (size < capacity)
+      {
+        size <<= 1;
+      }
+    m_ring.resize (size);
+    m_mask = size - 1;
+  }
+
+  ~TraceWriter ()
+  {
+    Stop ();
+    for (size_t i = 0; i < m_files.size (); ++i)
+      {
+        delete m_files[i];
+      }
+  }
+
+  /**
+   * Opens a file for a stream of records. Must be called before Start().
+   * Returns the stream id, or -1 if the file can not be opened.
+   */
+  int AddStream (const std::string &fileName, TraceFormatter formatter)
+  {
+    std::ofstream *file = new std::ofstream (fileName.c_str ());
+    if (!*file)
+      {
+        delete file;
+        return -1;
+      }
+    TraceColumnSink none = { 0, 0, 0, false };
+    m_files.push_back (file);
+    m_formatters.push_back (formatter);
+    m_columns.push_back (none);
+    return m_files.size () - 1;
+  }
+
+  /**
+   * Adds a stream whose records become rows of an open .col file.
+   * Must be called before Start(). Returns the stream id.
+   */
+  int AddColumnStream (ColumnTraceWriter *file, uint32_t flow, uint32_t event, bool real)
+  {
+    TraceColumnSink sink = { file, flow, event, real };
+    m_files.push_back (0);
+    m_formatters.push_back (0);
+    m_columns.push_back (sink);
+    return m_files.size () - 1;
+  }
+
+  /**
+   * Starts the background thread if async is true; otherwise records are
+   * written by the caller.
+   */
+  void Start (bool async)
+  {
+    m_async = async;
+    if (m_async && !m_running)
+      {
+        __atomic_store_n (&m_stop, 0, __ATOMIC_RELEASE);
+        if (pthread_create (&m_thread, 0, &TraceWriter::ThreadMain, this) != 0)
+          {
+            std::cerr << "trace writer: cannot start thread, writing synchronously" << std::endl;
+            m_async = false;
+            return;
+          }
+        m_running = true;
+      }
+  }
+
+  void WriteInt (uint32_t stream, double time, int64_t value, uint32_t tag = 0)
+  {
+    TraceRecord r;
+    r.time = time;
+    r.real = 0;
+    r.integer = value;
+    r.stream = stream;
+    r.tag = tag;
+    Push (r);
+  }
+
+  void WriteReal (uint32_t stream, double time, double value, uint32_t tag = 0)
+  {
+    TraceRecord r;
+    r.time = time;
+    r.real = value;
+    r.integer = 0;
+    r.stream = stream;
+    r.tag = tag;
+    Push (r);
+  }
+
+  /**
+   * Hands a record to the writer. Only one thread may call this.
+   */
+  void Push (const TraceRecord &record)
+  {
+    m_records++;
+    if (!m_async)
+      {
+        Emit (record);
+        return;
+      }
+    uint64_t tail = m_tail;
+    uint64_t head = __atomic_load_n (&m_head, __ATOMIC_ACQUIRE);
+    if (tail - head > m_mask)
+      {
+        // Ring full: back-pressure, wait for the writer thread to catch up
+        m_fullWaits++;
+        do
+          {
+            sched_yield ();
+            head = __atomic_load_n (&m_head, __ATOMIC_ACQUIRE);
+          }
+        while (tail - head > m_mask);
+      }
+    m_ring[tail & m_mask] = record;
+    __atomic_store_n (&m_tail, tail + 1, __ATOMIC_RELEASE);
+    if (tail + 1 - head > m_highWater)
+      {
+        m_highWater = tail + 1 - head;
+      }
+  }
+
+  /**
+   * Drains the ring, stops the background thread, flushes and closes every
+   * file and prints the back-pressure statistics. Safe to call twice; the
+   * .col files are let go of once closed, so they may be destroyed first.
+   */
+  void Stop ()
+  {
+    if (m_running)
+      {
+        __atomic_store_n (&m_stop, 1, __ATOMIC_RELEASE);
+        pthread_join (m_thread, 0);
+        m_running = false;
+        std::cerr << "Trace writer: " << m_records << " records, ring of " << m_ring.size ()
+                  << " filled up to " << m_highWater << ", simulator waited on a full ring "
+                  << m_fullWaits << " times" << std::endl;
+      }
+    for (size_t i = 0; i < m_files.size (); ++i)
+      {
+        if (m_files[i] && m_files[i]->is_open ())
+          {
+            m_files[i]->close ();
+          }
+        if (m_columns[i].file)
+          {
+            m_columns[i].file->Close ();
+            m_columns[i].file = 0;
+          }
+      }
+  }
+
+  uint64_t GetRecords () const
+  {
+    return m_records;
+  }
+
+  uint64_t GetFullWaits () const
+  {
+    return m_fullWaits;
+  }
+
+  uint64_t GetHighWater () const
+  {
+    return m_highWater;
+  }
+
+private:
+  void Emit (const TraceRecord &r)
+  {
+    const TraceColumnSink &sink = m_columns[r.stream];
+    if (sink.file)
+      {
+        sink.file->Append (r.time, sink.real ? r.real : r.integer, sink.flow, sink.event + r.tag);
+      }
+    else
+      {
+        m_formatters[r.stream] (*m_files[r.stream], r);
+      }
+  }
+
+  static void *ThreadMain (void *arg)
+  {
+    static_cast<TraceWriter *> (arg)->Drain ();
+    return 0;
+  }
+
+  void Drain ()
+  {
+    uint64_t head = m_head;
+    while (true)
+      {
+        uint64_t tail = __atomic_load_n (&m_tail, __ATOMIC_ACQUIRE);
+        if (head == tail)
+          {
+            // Check for stop only on an empty ring, so everything gets written
+            if (__atomic_load_n (&m_stop, __ATOMIC_ACQUIRE))
+              {
+                tail = __atomic_load_n (&m_tail, __ATOMIC_ACQUIRE);
+                if (head == tail)
+                  {
+                    break;
+                  }
+              }
+            else
+              {
+                usleep (100);
+                continue;
+              }
+          }
+        while (head != tail)
+          {
+            Emit (m_ring[head & m_mask]);
+            head++;
+            // Free slots as we go so a waiting producer can continue early
+            if ((head & 255) == 0)
+              {
+                __atomic_store_n (&m_head, head, __ATOMIC_RELEASE);
+              }
+          }
+        __atomic_store_n (&m_head, head, __ATOMIC_RELEASE);
+      }
+  }
+
+  std::vector<std::ofstream *> m_files;
+  std::vector<TraceFormatter> m_formatters;
+  std::vector<TraceColumnSink> m_columns;
+  std::vector<TraceRecord> m_ring;
+  uint64_t m_mask;
+  bool m_async;
+  bool m_running;
+  pthread_t m_thread;
+  // Consumer and producer positions on separate cache lines
+  char m_pad0[64];
+  uint64_t m_head;
+  char m_pad1[64];
+  uint64_t m_tail;
+  char m_pad2[64];
+  int m_stop;
+  // Producer side statistics
+  uint64_t m_records;
+  uint64_t m_fullWaits;
+  uint64_t m_highWater;
+};
+
+#endif /* LAB_TRACE_WRITER_H */
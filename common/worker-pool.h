@@ -0,0 +1,207 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+// Runs independent simulations in parallel.
+//
+// ns-3 keeps one global simulator per process, so a scenario can not be run
+// on several threads at once. Instead every job is executed in a fork()ed
+// child: the child builds, runs and destroys its own simulation, writes a
+// one-line result record into a pipe and exits. The parent keeps at most
+// 'jobs' children alive and hands each record back to the task.
+
+#ifndef LAB_WORKER_POOL_H
+#define LAB_WORKER_POOL_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * A batch of simulations. Run () is called in the worker (or in-process when
+ * only one job is allowed) and returns the result record for one index;
+ * Collect () is always called in the parent, in completion order.
+ */
+class WorkerTask
+{
+public:
+  virtual ~WorkerTask () {}
+  virtual std::string Run (uint32_t index) = 0;
+  virtual void Collect (uint32_t index, const std::string &record) = 0;
+};
+
+/**
+ * Bookkeeping for one forked worker: which job it runs, the read end of its
+ * result pipe and the part of the record received so far.
+ */
+struct WorkerSlot
+{
+  uint32_t index;
+  int fd;
+  std::string buffer;
+};
+
+/**
+ * Number of online processors; used when the user asks for --jobs=0.
+ */
+inline uint32_t
+WorkerPoolDefaultJobs (void)
+{
+  long n = sysconf (_SC_NPROCESSORS_ONLN);
+  return n > 0 ? static_cast<uint32_t> (n) : 1;
+}
+
+/**
+ * Runs task.Run () for every entry of indices with at most 'jobs' workers.
+ * With jobs == 1 everything runs in this process, one after the other, just
+ * like a plain loop around Simulator::Run () / Simulator::Destroy ().
+ * A worker that crashes or returns an empty record is reported on stderr and
+ * not collected, so a resumed sweep will simply try that point again.
+ */
+inline void
+RunWorkers (WorkerTask &task, const std::vector<uint32_t> &indices, uint32_t jobs)
+{
+  if (jobs == 0)
+    {
+      jobs = WorkerPoolDefaultJobs ();
+    }
+
+  if (jobs == 1)
+    {
+      for (size_t i = 0; i < indices.size (); ++i)
+        {
+          std::string record = task.Run (indices[i]);
+          if (!record.empty ())
+            {
+              task.Collect (indices[i], record);
+            }
+        }
+      return;
+    }
+
+  std::map<pid_t, WorkerSlot> running;
+  size_t next = 0;
+
+  while (next < indices.size () || !running.empty ())
+    {
+      while (running.size () < jobs && next < indices.size ())
+        {
+          int fds[2];
+          if (pipe (fds) != 0)
+            {
+              std::cerr << "worker pool: pipe failed: " << strerror (errno) << std::endl;
+              exit (1);
+            }
+          // Anything still buffered would otherwise be printed twice.
+          std::cout.flush ();
+          std::cerr.flush ();
+          pid_t pid = fork ();
+          if (pid < 0)
+            {
+              std::cerr << "worker pool: fork failed: " << strerror (errno) << std::endl;
+              exit (1);
+            }
+          if (pid == 0)
+            {
+              close (fds[0]);
+              std::string record = task.Run (indices[next]);
+              const char *data = record.c_str ();
+              size_t left = record.size ();
+              while (left > 0)
+                {
+                  ssize_t n = write (fds[1], data, left);
+                  if (n <= 0)
+                    {
+                      _exit (1);
+                    }
+                  data += n;
+                  left -= n;
+                }
+              close (fds[1]);
+              _exit (0);
+            }
+          close (fds[1]);
+          WorkerSlot w;
+          w.index = indices[next];
+          w.fd = fds[0];
+          running[pid] = w;
+          ++next;
+        }
+
+      // Drain every pipe that has data; a closed pipe means the worker is done.
+      std::vector<struct pollfd> pfds;
+      std::vector<pid_t> pids;
+      for (std::map<pid_t, WorkerSlot>::iterator it = running.begin (); it != running.end (); ++it)
+        {
+          struct pollfd p;
+          p.fd = it->second.fd;
+          p.events = POLLIN;
+          p.revents = 0;
+          pfds.push_back (p);
+          pids.push_back (it->first);
+        }
+      if (poll (&pfds[0], pfds.size (), -1) < 0)
+        {
+          if (errno == EINTR)
+            {
+              continue;
+            }
+          std::cerr << "worker pool: poll failed: " << strerror (errno) << std::endl;
+          exit (1);
+        }
+      for (size_t i = 0; i < pfds.size (); ++i)
+        {
+          if (pfds[i].revents == 0)
+            {
+              continue;
+            }
+          WorkerSlot &w = running[pids[i]];
+          char chunk[4096];
+          ssize_t n = read (w.fd, chunk, sizeof (chunk));
+          if (n > 0)
+            {
+              w.buffer.append (chunk, n);
+              continue;
+            }
+          if (n < 0 && errno == EINTR)
+            {
+              continue;
+            }
+          close (w.fd);
+          int status = 0;
+          waitpid (pids[i], &status, 0);
+          if (WIFEXITED (status) && WEXITSTATUS (status) == 0 && !w.buffer.empty ())
+            {
+              task.Collect (w.index, w.buffer);
+            }
+          else
+            {
+              std::cerr << "worker pool: job " << w.index << " failed" << std::endl;
+            }
+          running.erase (pids[i]);
+        }
+    }
+}
+
+#endif /* LAB_WORKER_POOL_H */
@@ -0,0 +1,121 @@
+#!/bin/sh
+#
+# Regression check of the lab programs.
+#
+# Copies every program into an ns-3 tree, builds it, runs it with a fixed seed
+# and compares the SHA-256 digests of its output (stdout and the .dat, .plt,
+# .txt, ascii trace and FlowMonitor XML files it writes) with
+# tools/regression.golden. The run time of every program is printed next to
+# the one recorded with the golden digests, so a change meant to make a
+# program faster can be checked for unchanged results in one go.
+#
+#   tools/regression.sh <ns-3 dir>            compare with the golden digests
+#   tools/regression.sh --update <ns-3 dir>   record new golden digests and times
+#
+# The programs go to <ns-3 dir>/scratch/<name>.cc and common/ to
+# <ns-3 dir>/common, where their "../common/..." includes find it. Stdout
+# lines that depend on the machine (wall clock times, trace writer ring
+# statistics) are left out of the digest. Exits with 1 if anything differs.
+
+set -e
+
+update=0
+if [ "$1" = "--update" ]; then
+  update=1
+  shift
+fi
+if [ $# -ne 1 ] || [ ! -x "$1/waf" ]; then
+  echo "usage: $0 [--update] <ns-3 dir>" >&2
+  exit 2
+fi
+
+ns3=$(cd "$1" && pwd)
+repo=$(cd "$(dirname "$0")/.." && pwd)
+golden="$repo/tools/regression.golden"
+times="$repo/tools/regression.times"
+seed="--RngSeed=1 --RngRun=1"
+
+# name|source|arguments|output files
+cases='first|1/first.cc|--pairs=4 --packets=10 --interval=0.1|lab-4-1.tr
+second|2/second.cc||lossVsTime.txt globalRouting.tr assign-2.flowmon
+third|3/third.cc||Cwnd0.dat Cwnd1.dat Cwnd2.dat Cwnd3.dat Cwnd4.dat Recv0.dat Recv1.dat Recv2.dat Recv3.dat Recv4.dat queue.dat
+fourth1|4/fourth1.cc||plot1.plt plot2.plt lab3-rtt.tr
+fourth2|4/fourth2.cc|--jobs=1|plot3.plt plot4.plt lab3-rtt.tr'
+
+if command -v sha256sum > /dev/null; then
+  digest () { sha256sum | cut -d ' ' -f 1; }
+else
+  digest () { shasum -a 256 | cut -d ' ' -f 1; }
+fi
+
+now () { date +%s.%N; }
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+mkdir -p "$ns3/common"
+cp "$repo"/common/*.h "$ns3/common/"
+echo "$cases" | while IFS='|' read name source args outputs; do
+  cp "$repo/$source" "$ns3/scratch/$name.cc"
+done
+(cd "$ns3" && ./waf build > "$work/build.log" 2>&1) || {
+  cat "$work/build.log" >&2
+  exit 1
+}
+
+: > "$work/digests"
+: > "$work/times"
+echo "$cases" | while IFS='|' read name source args outputs; do
+  mkdir "$work/$name"
+  start=$(now)
+  if ! (cd "$ns3" && ./waf --cwd="$work/$name" --run "$name $args $seed") > "$work/$name.out" 2>&1; then
+    echo "$name: run failed" >&2
+    cat "$work/$name.out" >&2
+    echo "$name stdout failed" >> "$work/digests"
+    continue
+  fi
+  end=$(now)
+  echo "$name $(echo "$start $end" | awk '{ printf "%.2f", $2 - $1 }')" >> "$work/times"
+
+  grep -v -e "^Waf: " -e "^'build' finished" -e "wall clock" -e "^Trace writer:" "$work/$name.out" \
+    | digest | sed "s/^/$name stdout /" >> "$work/digests"
+  for file in $outputs; do
+    if [ -f "$work/$name/$file" ]; then
+      echo "$name $file $(digest < "$work/$name/$file")" >> "$work/digests"
+    else
+      echo "$name $file missing" >> "$work/digests"
+    fi
+  done
+done
+
+if [ $update -eq 1 ]; then
+  cp "$work/digests" "$golden"
+  cp "$work/times" "$times"
+  echo "Recorded $(wc -l < "$golden") digests in $golden"
+  exit 0
+fi
+
+echo "Run times (s), this build vs. golden:"
+while read name seconds; do
+  was=
+  if [ -f "$times" ]; then
+    was=$(awk -v n="$name" '$1 == n { print $2 }' "$times")
+  fi
+  if [ -n "$was" ]; then
+    echo "$name $seconds $was" | awk '{ printf "  %-8s %8.2f %8.2f  (x%.2f)\n", $1, $2, $3, ($3 > 0 ? $2 / $3 : 0) }'
+  else
+    printf "  %-8s %8.2f        -\n" "$name" "$seconds"
+  fi
+done < "$work/times"
+
+if [ ! -f "$golden" ]; then
+  echo "No golden digests yet; run with --update on a known good build first." >&2
+  exit 1
+fi
+if diff "$golden" "$work/digests" > "$work/diff"; then
+  echo "All $(wc -l < "$golden") outputs match the golden digests."
+else
+  echo "Outputs differ from the golden digests (< golden, > this build):"
+  grep '^[<>]' "$work/diff"
+  exit 1
+fi
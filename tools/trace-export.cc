@@ -0,0 +1,164 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+// Exports a slice of a binary .col trace (see common/column-trace.h) as text.
+// Does not need ns-3:
+//
+//   g++ -O2 -o trace-export tools/trace-export.cc
+//   ./trace-export third.col --info
+//   ./trace-export third.col --from=10 --to=20 --flow=2 --event=cwnd --xy
+//
+// The time range is located by binary search, so only the pages of the
+// requested slice are read, whatever the size of the file. --xy prints just
+// "time value", which gnuplot can plot directly:
+//
+//   plot "< ./trace-export third.col --event=cwnd --flow=0 --xy" with lines
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include "../common/column-trace.h"
+
+using namespace std;
+
+static void
+Usage (void)
+{
+  cerr << "usage: trace-export <file.col> [--info] [--from=<s>] [--to=<s>]"
+       << " [--flow=<n>] [--event=<name>] [--xy]" << endl;
+  exit (1);
+}
+
+int
+main (int argc, char *argv[])
+{
+  if (argc < 2)
+    {
+      Usage ();
+    }
+
+  string fileName = argv[1];
+  double from = 0;
+  double to = -1;
+  bool haveFlow = false;
+  uint32_t flow = 0;
+  string eventName = "";
+  bool info = false;
+  bool xy = false;
+
+  for (int i = 2; i < argc; ++i)
+    {
+      string arg = argv[i];
+      if (arg.compare (0, 7, "--from=") == 0)
+        {
+          from = atof (arg.c_str () + 7);
+        }
+      else if (arg.compare (0, 5, "--to=") == 0)
+        {
+          to = atof (arg.c_str () + 5);
+        }
+      else if (arg.compare (0, 7, "--flow=") == 0)
+        {
+          haveFlow = true;
+          flow = strtoul (arg.c_str () + 7, 0, 10);
+        }
+      else if (arg.compare (0, 8, "--event=") == 0)
+        {
+          eventName = arg.substr (8);
+        }
+      else if (arg == "--info")
+        {
+          info = true;
+        }
+      else if (arg == "--xy")
+        {
+          xy = true;
+        }
+      else
+        {
+          Usage ();
+        }
+    }
+
+  ColumnTraceReader trace;
+  if (!trace.Open (fileName))
+    {
+      cerr << fileName << ": not a readable .col trace" << endl;
+      return 1;
+    }
+
+  if (info)
+    {
+      uint64_t rows = trace.GetRowCount ();
+      cout << fileName << ": " << rows << " rows";
+      if (rows > 0)
+        {
+          cout << ", " << trace.Time (0) << "s to " << trace.Time (rows - 1) << "s";
+        }
+      cout << endl << "events:";
+      for (uint32_t e = 0; e < trace.GetEventCount (); ++e)
+        {
+          cout << " " << trace.GetEventName (e);
+        }
+      cout << endl;
+      return 0;
+    }
+
+  // Resolve the event name once instead of comparing strings per row
+  bool haveEvent = !eventName.empty ();
+  uint32_t event = 0;
+  if (haveEvent)
+    {
+      for (event = 0; event < trace.GetEventCount (); ++event)
+        {
+          if (trace.GetEventName (event) == eventName)
+            {
+              break;
+            }
+        }
+      if (event == trace.GetEventCount ())
+        {
+          cerr << fileName << ": no event named '" << eventName << "'" << endl;
+          return 1;
+        }
+    }
+
+  uint64_t end = to < 0 ? trace.GetRowCount () : trace.LowerBound (to);
+  for (uint64_t row = trace.LowerBound (from); row < end; ++row)
+    {
+      if ((haveFlow && trace.Flow (row) != flow) || (haveEvent && trace.Event (row) != event))
+        {
+          continue;
+        }
+      if (xy)
+        {
+          cout << trace.Time (row) << " " << trace.Value (row) << "\n";
+          continue;
+        }
+      cout << trace.Time (row) << "\t";
+      if (trace.Flow (row) == COLUMN_NO_FLOW)
+        {
+          cout << "-";
+        }
+      else
+        {
+          cout << trace.Flow (row);
+        }
+      cout << "\t" << trace.GetEventName (trace.Event (row)) << "\t" << trace.Value (row) << "\n";
+    }
+  return 0;
+}